@@ -0,0 +1,675 @@
+
+#include <bit>
+
+#if defined( _M_X64 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define COLLECTIONS_SSE2 1
+#else
+#define COLLECTIONS_SSE2 0
+#endif
+
+#include "collections.h"
+#include "interpreter.h"
+
+// -- dict --
+
+// A full slot's control byte is the low 7 bits of its hash
+constexpr u8 DictEmpty = 0x80;
+constexpr u8 DictDeleted = 0xFE;
+
+static u64 hash_mix( u64 hash )
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static u64 hash_bytes( std::string_view str )
+{
+	u64 hash = 0xcbf29ce484222325ull;
+	for ( char c : str )
+	{
+		hash ^= static_cast<u8>( c );
+		hash *= 0x100000001b3ull;
+	}
+	return hash_mix( hash );
+}
+
+// Bit per control byte of the group that equals byte
+static u32 group_match( const u8 *group, u8 byte )
+{
+#if COLLECTIONS_SSE2
+	__m128i ctrl = _mm_loadu_si128( reinterpret_cast<const __m128i *>( group ) );
+	return static_cast<u32>( _mm_movemask_epi8( _mm_cmpeq_epi8( ctrl, _mm_set1_epi8( static_cast<char>( byte ) ) ) ) );
+#else
+	u32 bits = 0;
+	for ( u32 i = 0; i < DictGroupSize; ++i )
+		bits |= static_cast<u32>( group[ i ] == byte ) << i;
+	return bits;
+#endif
+}
+
+// Bit per slot of the group that is empty or deleted, both have the top bit set
+static u32 group_free( const u8 *group )
+{
+#if COLLECTIONS_SSE2
+	return static_cast<u32>( _mm_movemask_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( group ) ) ) );
+#else
+	u32 bits = 0;
+	for ( u32 i = 0; i < DictGroupSize; ++i )
+		bits |= static_cast<u32>( group[ i ] >> 7 ) << i;
+	return bits;
+#endif
+}
+
+static bool key_equal( const DictKey &lhs, const DictKeyView &rhs )
+{
+	if ( lhs.type != rhs.type )
+		return false;
+	if ( lhs.type == ValueType::NumberI64 )
+		return lhs.integer == rhs.integer;
+	return lhs.string == rhs.string;
+}
+
+bool dict_key( const Value &value, DictKeyView *key, u64 *hash )
+{
+	const Value &v = value.deref();
+
+	switch ( v.type )
+	{
+	case ValueType::NumberI32:
+	case ValueType::NumberI64:
+		key->type = ValueType::NumberI64;
+		key->integer = ( v.type == ValueType::NumberI32 ? v.valueI32 : v.valueI64 );
+		key->string = {};
+		*hash = hash_mix( static_cast<u64>( key->integer ) );
+		return true;
+
+	case ValueType::StringLiteral:
+		key->type = ValueType::StringLiteral;
+		key->integer = 0;
+		key->string = v.valueString;
+		*hash = hash_bytes( v.valueString );
+		return true;
+
+	case ValueType::Bytes:
+		key->type = ValueType::StringLiteral;
+		key->integer = 0;
+		key->string = text_view( v );
+		*hash = hash_bytes( key->string );
+		return true;
+	}
+
+	return false;
+}
+
+i64 Dict::find_slot( const DictKeyView &key, u64 hash ) const
+{
+	if ( control.empty() )
+		return -1;
+
+	u8 h2 = static_cast<u8>( hash & 0x7F );
+	u64 pos = ( hash >> 7 ) & mask;
+
+	// triangular steps of whole groups reach every group of a power of two table
+	for ( u64 step = DictGroupSize; ; step += DictGroupSize )
+	{
+		const u8 *group = &control[ pos ];
+
+		for ( u32 bits = group_match( group, h2 ); bits; bits &= bits - 1 )
+		{
+			u64 slot = ( pos + std::countr_zero( bits ) ) & mask;
+			u32 entry = slots[ slot ];
+			if ( hashes[ entry ] == hash && key_equal( keys[ entry ], key ) )
+				return static_cast<i64>( slot );
+		}
+
+		if ( group_match( group, DictEmpty ) )
+			return -1;
+
+		pos = ( pos + step ) & mask;
+	}
+}
+
+u64 Dict::find_free( u64 hash ) const
+{
+	u64 pos = ( hash >> 7 ) & mask;
+
+	for ( u64 step = DictGroupSize; ; step += DictGroupSize )
+	{
+		u32 bits = group_free( &control[ pos ] );
+		if ( bits )
+			return ( pos + std::countr_zero( bits ) ) & mask;
+
+		pos = ( pos + step ) & mask;
+	}
+}
+
+u64 Dict::slot_of( u64 entry ) const
+{
+	u64 hash = hashes[ entry ];
+	u8 h2 = static_cast<u8>( hash & 0x7F );
+	u64 pos = ( hash >> 7 ) & mask;
+
+	for ( u64 step = DictGroupSize; ; step += DictGroupSize )
+	{
+		for ( u32 bits = group_match( &control[ pos ], h2 ); bits; bits &= bits - 1 )
+		{
+			u64 slot = ( pos + std::countr_zero( bits ) ) & mask;
+			if ( slots[ slot ] == entry )
+				return slot;
+		}
+
+		pos = ( pos + step ) & mask;
+	}
+}
+
+// The first group's control bytes are repeated past the end, so a group
+// starting near the end can be loaded without wrapping
+void Dict::set_control( u64 slot, u8 byte )
+{
+	control[ slot ] = byte;
+	if ( slot < DictGroupSize )
+		control[ mask + 1 + slot ] = byte;
+}
+
+void Dict::rehash( u64 capacity )
+{
+	control.assign( capacity + DictGroupSize, DictEmpty );
+	slots.assign( capacity, 0 );
+	mask = capacity - 1;
+	tombstones = 0;
+
+	for ( u64 entry = 0; entry < keys.size(); ++entry )
+	{
+		u64 slot = find_free( hashes[ entry ] );
+		set_control( slot, static_cast<u8>( hashes[ entry ] & 0x7F ) );
+		slots[ slot ] = static_cast<u32>( entry );
+	}
+}
+
+void Dict::unpack()
+{
+	if ( !packed )
+		return;
+
+	values.reserve( ints.size() );
+	for ( i64 value : ints )
+		values.emplace_back( value );
+
+	ints.clear();
+	ints.shrink_to_fit();
+	packed = false;
+}
+
+i64 Dict::find( const DictKeyView &key, u64 hash ) const
+{
+	i64 slot = find_slot( key, hash );
+	return slot < 0 ? -1 : static_cast<i64>( slots[ slot ] );
+}
+
+Value Dict::key_at( u64 entry ) const
+{
+	const DictKey &key = keys[ entry ];
+	if ( key.type == ValueType::NumberI64 )
+		return key.integer;
+	return key.string;
+}
+
+Value Dict::value_at( u64 entry ) const
+{
+	return packed ? Value( ints[ entry ] ) : values[ entry ];
+}
+
+void Dict::set( const DictKeyView &key, u64 hash, const Value &value )
+{
+	const Value &v = value.deref();
+
+	i64 slot = find_slot( key, hash );
+	if ( slot >= 0 )
+	{
+		u32 entry = slots[ slot ];
+		if ( packed && v.type == ValueType::NumberI64 )
+		{
+			ints[ entry ] = v.valueI64;
+			return;
+		}
+		unpack();
+		values[ entry ] = v;
+		return;
+	}
+
+	// at most 7 in 8 slots are full or deleted, so a probe always ends
+	u64 capacity = mask + 1;
+	if ( control.empty() )
+		rehash( DictMinCapacity );
+	else if ( ( keys.size() + tombstones + 1 ) * 8 > capacity * 7 )
+		rehash( ( keys.size() + 1 ) * 16 > capacity * 7 ? capacity * 2 : capacity );
+
+	u64 free = find_free( hash );
+	if ( control[ free ] == DictDeleted )
+		tombstones -= 1;
+	set_control( free, static_cast<u8>( hash & 0x7F ) );
+	slots[ free ] = static_cast<u32>( keys.size() );
+
+	keys.push_back( { key.type, key.integer, std::string( key.string ) } );
+	hashes.push_back( hash );
+
+	if ( packed && v.type != ValueType::NumberI64 )
+		unpack();
+	if ( packed )
+		ints.push_back( v.valueI64 );
+	else
+		values.push_back( v );
+}
+
+bool Dict::remove( const DictKeyView &key, u64 hash )
+{
+	i64 slot = find_slot( key, hash );
+	if ( slot < 0 )
+		return false;
+
+	u64 entry = slots[ slot ];
+	u64 last = keys.size() - 1;
+
+	set_control( slot, DictDeleted );
+	tombstones += 1;
+
+	if ( entry != last )
+	{
+		slots[ slot_of( last ) ] = static_cast<u32>( entry );
+		keys[ entry ] = std::move( keys[ last ] );
+		hashes[ entry ] = hashes[ last ];
+		if ( packed )
+			ints[ entry ] = ints[ last ];
+		else
+			values[ entry ] = std::move( values[ last ] );
+	}
+
+	keys.pop_back();
+	hashes.pop_back();
+	if ( packed )
+		ints.pop_back();
+	else
+		values.pop_back();
+
+	return true;
+}
+
+std::string Dict::to_string() const
+{
+	std::string temp = "{ ";
+	for ( u64 entry = 0; entry < keys.size(); ++entry )
+		std::format_to( std::back_inserter( temp ), "{}{}:{}", entry ? ", " : "", key_at( entry ), value_at( entry ) );
+	temp += " }";
+	return temp;
+}
+
+// -- deque --
+
+void Deque::grow()
+{
+	std::vector<Value> larger( buffer.empty() ? DequeMinCapacity : buffer.size() * 2 );
+	for ( u64 i = 0; i < size; ++i )
+		larger[ i ] = std::move( at( i ) );
+
+	buffer = std::move( larger );
+	head = 0;
+}
+
+void Deque::push_front( const Value &value )
+{
+	if ( size == buffer.size() )
+		grow();
+
+	head = ( head - 1 ) & ( buffer.size() - 1 );
+	size += 1;
+	at( 0 ) = value.deref();
+}
+
+void Deque::push_back( const Value &value )
+{
+	if ( size == buffer.size() )
+		grow();
+
+	size += 1;
+	at( size - 1 ) = value.deref();
+}
+
+// the emptied slot is cleared so it doesn't keep a string or array alive
+Value Deque::pop_front()
+{
+	Value &slot = at( 0 );
+	Value ret = std::move( slot );
+	slot.clear();
+
+	head = ( head + 1 ) & ( buffer.size() - 1 );
+	size -= 1;
+	return ret;
+}
+
+Value Deque::pop_back()
+{
+	Value &slot = at( size - 1 );
+	Value ret = std::move( slot );
+	slot.clear();
+
+	size -= 1;
+	return ret;
+}
+
+std::string Deque::to_string() const
+{
+	std::string temp = "[ ";
+	for ( u64 i = 0; i < size; ++i )
+		std::format_to( std::back_inserter( temp ), "{}{}", i ? ", " : "", buffer[ ( head + i ) & ( buffer.size() - 1 ) ] );
+	std::format_to( std::back_inserter( temp ), "]({})", size );
+	return temp;
+}
+
+// -- heap --
+
+// Whether an entry of priority and ord belongs above the one at entry
+bool Heap::before( i64 priority, u64 ord, u64 entry ) const
+{
+	if ( priority != priorities[ entry ] )
+		return max ? priority > priorities[ entry ] : priority < priorities[ entry ];
+	return ord < order[ entry ];
+}
+
+// Moves the hole towards the root past every parent the entry goes above, then fills it
+void Heap::sift_up( u64 hole, i64 priority, u64 ord, Value &&value )
+{
+	while ( hole > 0 )
+	{
+		u64 parent = ( hole - 1 ) / HeapArity;
+		if ( !before( priority, ord, parent ) )
+			break;
+
+		priorities[ hole ] = priorities[ parent ];
+		order[ hole ] = order[ parent ];
+		values[ hole ] = std::move( values[ parent ] );
+		hole = parent;
+	}
+
+	priorities[ hole ] = priority;
+	order[ hole ] = ord;
+	values[ hole ] = std::move( value );
+}
+
+void Heap::sift_down( u64 hole, i64 priority, u64 ord, Value &&value )
+{
+	u64 size = values.size();
+
+	for ( ;; )
+	{
+		u64 first = hole * HeapArity + 1;
+		if ( first >= size )
+			break;
+
+		u64 best = first;
+		for ( u64 child = first + 1; child < first + HeapArity && child < size; ++child )
+		{
+			if ( before( priorities[ child ], order[ child ], best ) )
+				best = child;
+		}
+
+		if ( before( priority, ord, best ) )
+			break;
+
+		priorities[ hole ] = priorities[ best ];
+		order[ hole ] = order[ best ];
+		values[ hole ] = std::move( values[ best ] );
+		hole = best;
+	}
+
+	priorities[ hole ] = priority;
+	order[ hole ] = ord;
+	values[ hole ] = std::move( value );
+}
+
+void Heap::push( const Value &value, i64 priority )
+{
+	priorities.push_back( priority );
+	order.push_back( pushed );
+	values.emplace_back();
+
+	sift_up( values.size() - 1, priority, pushed, Value( value.deref() ) );
+	pushed += 1;
+}
+
+Value Heap::pop()
+{
+	Value ret = std::move( values[ 0 ] );
+	values[ 0 ].clear();
+
+	i64 priority = priorities.back();
+	u64 ord = order.back();
+	Value last = std::move( values.back() );
+
+	priorities.pop_back();
+	order.pop_back();
+	values.pop_back();
+
+	if ( !values.empty() )
+		sift_down( 0, priority, ord, std::move( last ) );
+
+	return ret;
+}
+
+std::string Heap::to_string() const
+{
+	std::string temp = "[ ";
+	for ( u64 i = 0; i < values.size(); ++i )
+		std::format_to( std::back_inserter( temp ), "{}{}:{}", i ? ", " : "", values[ i ], priorities[ i ] );
+	std::format_to( std::back_inserter( temp ), "]({})", values.size() );
+	return temp;
+}
+
+// -- script interface --
+
+static Dict &dict_of( Value &self )
+{
+	return static_cast<Dict &>( *self.deref().collection );
+}
+
+// The key views the text of value, which has to outlive the lookup
+static void expect_key( Interpreter *interpreter, Node *arg, const Value &value, DictKeyView *key, u64 *hash )
+{
+	if ( !dict_key( value, key, hash ) )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, arg, "Dict keys are integers or strings, got {}.", value.deref().type );
+}
+
+Value BuiltInNode_Struct_Collections_Dict( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "dict", args, 0 );
+	return Value( ValueType::Dict );
+}
+
+// get( key ) or get( key, fallback ), Undefined or the fallback when the key isn't there
+Value BuiltInNode_Dict_Get( Interpreter *interpreter, Value &self, Node *args )
+{
+	if ( args->children.size() != 1 && args->children.size() != 2 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "get received incorrect arguments." );
+
+	Value keyValue = interpreter->run( args->children[ 0 ] );
+	DictKeyView key;
+	u64 hash;
+	expect_key( interpreter, args->children[ 0 ], keyValue, &key, &hash );
+
+	Dict &dict = dict_of( self );
+	i64 entry = dict.find( key, hash );
+	if ( entry >= 0 )
+		return dict.value_at( entry );
+
+	if ( args->children.size() == 2 )
+	{
+		Value fallback = interpreter->run( args->children[ 1 ] );
+		fallback.unfold();
+		return fallback;
+	}
+
+	return Value();
+}
+
+Value BuiltInNode_Dict_Set( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "set", args, 2 );
+
+	// both are run before the key views the text, running the value may
+	// assign to the variable holding the key
+	Value keyValue = interpreter->run( args->children[ 0 ] );
+	Value value = interpreter->run( args->children[ 1 ] );
+	DictKeyView key;
+	u64 hash;
+	expect_key( interpreter, args->children[ 0 ], keyValue, &key, &hash );
+
+	dict_of( self ).set( key, hash, value );
+	return 0;
+}
+
+Value BuiltInNode_Dict_Has( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "has", args, 1 );
+
+	Value keyValue = interpreter->run( args->children[ 0 ] );
+	DictKeyView key;
+	u64 hash;
+	expect_key( interpreter, args->children[ 0 ], keyValue, &key, &hash );
+
+	return static_cast<i32>( dict_of( self ).find( key, hash ) >= 0 );
+}
+
+Value BuiltInNode_Dict_Remove( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "remove", args, 1 );
+
+	Value keyValue = interpreter->run( args->children[ 0 ] );
+	DictKeyView key;
+	u64 hash;
+	expect_key( interpreter, args->children[ 0 ], keyValue, &key, &hash );
+
+	return static_cast<i32>( dict_of( self ).remove( key, hash ) );
+}
+
+Value BuiltInNode_Dict_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "count", args, 0 );
+	return static_cast<i64>( dict_of( self ).count() );
+}
+
+static Deque &deque_of( Value &self )
+{
+	return static_cast<Deque &>( *self.deref().collection );
+}
+
+static Deque &expect_entries( Interpreter *interpreter, Value &self, Node *args, const char *name )
+{
+	interpreter->expect_arg( name, args, 0 );
+
+	Deque &deque = deque_of( self );
+	if ( !deque.count() )
+		interpreter->fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, args, "{} on an empty deque.", name );
+	return deque;
+}
+
+Value BuiltInNode_Struct_Collections_Deque( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "deque", args, 0 );
+	return Value( ValueType::Deque );
+}
+
+Value BuiltInNode_Deque_PushFront( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "push_front", args, 1 );
+	deque_of( self ).push_front( interpreter->run( args->children[ 0 ] ) );
+	return 0;
+}
+
+Value BuiltInNode_Deque_PushBack( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "push_back", args, 1 );
+	deque_of( self ).push_back( interpreter->run( args->children[ 0 ] ) );
+	return 0;
+}
+
+Value BuiltInNode_Deque_PopFront( Interpreter *interpreter, Value &self, Node *args )
+{
+	return expect_entries( interpreter, self, args, "pop_front" ).pop_front();
+}
+
+Value BuiltInNode_Deque_PopBack( Interpreter *interpreter, Value &self, Node *args )
+{
+	return expect_entries( interpreter, self, args, "pop_back" ).pop_back();
+}
+
+Value BuiltInNode_Deque_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "count", args, 0 );
+	return static_cast<i64>( deque_of( self ).count() );
+}
+
+static Heap &heap_of( Value &self )
+{
+	return static_cast<Heap &>( *self.deref().collection );
+}
+
+// heap() pops the lowest priority first, heap( "max" ) the highest
+Value BuiltInNode_Struct_Collections_Heap( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	if ( args->children.size() > 1 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "heap received incorrect arguments." );
+
+	Value heap( ValueType::Heap );
+	if ( args->children.size() == 1 )
+	{
+		std::string ordering = interpreter->run( args->children[ 0 ] ).get_as_string( interpreter, args->children[ 0 ] );
+		if ( ordering != "min" && ordering != "max" )
+			interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args->children[ 0 ], "heap ordering is \"min\" or \"max\", got \"{}\".", ordering );
+		heap_of( heap ).max = ( ordering == "max" );
+	}
+	return heap;
+}
+
+Value BuiltInNode_Heap_Push( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "push", args, 2 );
+
+	Value value = interpreter->run( args->children[ 0 ] );
+	i64 priority = interpreter->run( args->children[ 1 ] ).get_as_i64( interpreter, args->children[ 1 ] );
+
+	heap_of( self ).push( value, priority );
+	return 0;
+}
+
+Value BuiltInNode_Heap_Pop( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "pop", args, 0 );
+
+	Heap &heap = heap_of( self );
+	if ( !heap.count() )
+		interpreter->fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, args, "pop on an empty heap." );
+	return heap.pop();
+}
+
+Value BuiltInNode_Heap_Peek( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "peek", args, 0 );
+
+	Heap &heap = heap_of( self );
+	if ( !heap.count() )
+		interpreter->fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, args, "peek on an empty heap." );
+	return heap.values[ 0 ];
+}
+
+Value BuiltInNode_Heap_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "count", args, 0 );
+	return static_cast<i64>( heap_of( self ).count() );
+}
@@ -0,0 +1,155 @@
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "value.h"
+
+// Containers a Value holds by reference, as it does a file. Assigning one or
+// passing it to a function shares the entries instead of copying them.
+struct Collection
+{
+	// Values holding it, deleted when the last one lets go. Values are only
+	// copied on the interpreter's thread, so the count isn't atomic.
+	u32 refs = 1;
+
+	virtual ~Collection() = default;
+	virtual u64 count() const = 0;
+	virtual std::string to_string() const = 0;
+};
+
+// Slots a Dict starts with, and the control bytes matched at once
+constexpr u64 DictMinCapacity = 16;
+constexpr u64 DictGroupSize = 16;
+
+struct DictKey
+{
+	ValueType type;
+	i64 integer;
+	std::string string;
+};
+
+// A key as it is looked up, the text is the Value's own and is only copied
+// into a DictKey when set adds the entry
+struct DictKeyView
+{
+	ValueType type;
+	i64 integer;
+	std::string_view string;
+};
+
+// Open addressing hash map in the style of a Swiss table. Every slot has a
+// control byte with 7 bits of the hash, or a mark for empty or deleted, and a
+// group of them is compared with one instruction. Slots index dense entry
+// arrays, which keep insertion order for iteration and stay compact on removal
+// by moving the last entry into the gap.
+struct Dict : Collection
+{
+	std::vector<u8> control;
+	std::vector<u32> slots;
+	u64 mask = 0;
+	u64 tombstones = 0;
+
+	std::vector<DictKey> keys;
+	std::vector<u64> hashes;
+	// values stay packed while every one is an i64, as arrays do
+	std::vector<i64> ints;
+	std::vector<Value> values;
+	bool packed = true;
+
+	u64 count() const override { return keys.size(); }
+	std::string to_string() const override;
+
+	i64 find( const DictKeyView &key, u64 hash ) const;
+	Value key_at( u64 entry ) const;
+	Value value_at( u64 entry ) const;
+	void set( const DictKeyView &key, u64 hash, const Value &value );
+	bool remove( const DictKeyView &key, u64 hash );
+
+private:
+	i64 find_slot( const DictKeyView &key, u64 hash ) const;
+	u64 find_free( u64 hash ) const;
+	u64 slot_of( u64 entry ) const;
+	void set_control( u64 slot, u8 byte );
+	void rehash( u64 capacity );
+	void unpack();
+};
+
+bool dict_key( const Value &value, DictKeyView *key, u64 *hash );
+
+// Slots a Deque starts with once something is pushed
+constexpr u64 DequeMinCapacity = 16;
+
+// Ring buffer over a power of two slots. Both ends move by one slot in O(1),
+// and growing unrolls the ring into a buffer twice the size.
+struct Deque : Collection
+{
+	std::vector<Value> buffer;
+	u64 head = 0;
+	u64 size = 0;
+
+	u64 count() const override { return size; }
+	std::string to_string() const override;
+
+	Value &at( u64 index ) { return buffer[ ( head + index ) & ( buffer.size() - 1 ) ]; }
+	void push_front( const Value &value );
+	void push_back( const Value &value );
+	Value pop_front();
+	Value pop_back();
+
+private:
+	void grow();
+};
+
+// Children per node of a Heap. Four children of a node share a cache line of
+// priorities, and the tree is half as deep as a binary one.
+constexpr u64 HeapArity = 4;
+
+// d-ary priority queue. Priorities are packed apart from the values so a sift
+// only compares a dense i64 array, and entries of equal priority pop in the
+// order they were pushed.
+struct Heap : Collection
+{
+	std::vector<i64> priorities;
+	std::vector<u64> order;
+	std::vector<Value> values;
+	u64 pushed = 0;
+	bool max = false;
+
+	u64 count() const override { return values.size(); }
+	std::string to_string() const override;
+
+	void push( const Value &value, i64 priority );
+	Value pop();
+
+private:
+	bool before( i64 priority, u64 ord, u64 entry ) const;
+	void sift_up( u64 hole, i64 priority, u64 ord, Value &&value );
+	void sift_down( u64 hole, i64 priority, u64 ord, Value &&value );
+};
+
+Value BuiltInNode_Struct_Collections_Dict( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_Dict_Get( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Dict_Set( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Dict_Has( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Dict_Remove( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Dict_Count( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_Struct_Collections_Deque( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_Deque_PushFront( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Deque_PushBack( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Deque_PopFront( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Deque_PopBack( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Deque_Count( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_Struct_Collections_Heap( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_Heap_Push( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Heap_Pop( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Heap_Peek( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Heap_Count( Interpreter *interpreter, Value &self, Node *args );
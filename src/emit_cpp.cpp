@@ -0,0 +1,559 @@
+
+#include <fstream>
+#include <print>
+
+#include "emit_cpp.h"
+
+// Statement lists the interpreter runs child by child. Translated statements in
+// them are swapped for Native nodes that call the generated code.
+static bool runs_statements( Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Entry:
+	case NodeID::DeclFunc:
+	case NodeID::ForOfIdentifier:
+	case NodeID::ForOfIdentifierRange:
+	case NodeID::ForOfIdentifierRangeCount:
+		return true;
+	}
+	return false;
+}
+
+static bool is_translated( Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Block:
+	case NodeID::Identifier:
+	case NodeID::CreateIdentifier:
+	case NodeID::StringLiteral:
+	case NodeID::Number:
+	case NodeID::Operation:
+	case NodeID::FunctionCall:
+	case NodeID::If:
+	case NodeID::IfCompare:
+	case NodeID::Return:
+	case NodeID::ForNumberRange:
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		return true;
+
+	// the interpreter writes an indexed target back through array_store
+	case NodeID::Assignment:
+	case NodeID::AssignmentOp:
+	case NodeID::AssignmentOpConst:
+		return node->left->type != NodeID::ArrayAccess;
+	}
+	return false;
+}
+
+static void number_nodes( CppEmitter *emitter, Node *node )
+{
+	if ( !node || emitter->nodes.contains( node ) )
+		return;
+
+	emitter->nodes[ node ] = static_cast<u32>( emitter->order.size() );
+	emitter->order.push_back( node );
+
+	if ( node->token && !emitter->tokens.contains( node->token ) )
+	{
+		emitter->tokens[ node->token ] = static_cast<u32>( emitter->tokenOrder.size() );
+		emitter->tokenOrder.push_back( node->token );
+	}
+
+	number_nodes( emitter, node->left );
+	number_nodes( emitter, node->right );
+	for ( auto child : node->children )
+		number_nodes( emitter, child );
+	if ( node->value.type == ValueType::Node )
+		number_nodes( emitter, node->value.valueNode );
+}
+
+static std::string quote( const std::string &str )
+{
+	std::string quoted = "\"";
+	for ( char c : str )
+	{
+		u8 ch = static_cast<u8>( c );
+		if ( ch == '"' || ch == '\\' )
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if ( ch >= 32 && ch < 127 )
+		{
+			quoted += c;
+		}
+		else
+		{
+			quoted += std::format( "\\{:03o}", ch );
+		}
+	}
+	return quoted + "\"";
+}
+
+static bool emit_value( CppEmitter *emitter, const Value &value, std::string *out )
+{
+	switch ( value.type )
+	{
+	case ValueType::Undefined:		*out = "Value()"; return true;
+	case ValueType::NumberI32:		*out = std::format( "Value( static_cast<i32>( {} ) )", value.valueI32 ); return true;
+	case ValueType::NumberI64:		*out = std::format( "Value( static_cast<i64>( {}ull ) )", static_cast<u64>( value.valueI64 ) ); return true;
+	case ValueType::StringLiteral:	*out = std::format( "Value( std::string( {}, {} ) )", quote( value.valueString ), value.valueString.size() ); return true;
+	case ValueType::TokenID:		*out = std::format( "Value( TokenID::{}, {} )", TokenTypes[ static_cast<i32>( value.tokenID ) ].name, quote( value.valueString ) ); return true;
+	case ValueType::KeywordID:		*out = std::format( "Value( static_cast<KeywordID>( {} ), {} )", static_cast<i32>( value.keywordID ), quote( value.valueString ) ); return true;
+	case ValueType::Command:		*out = std::format( "Value( static_cast<KeywordID>( {} ) )", static_cast<i32>( value.keywordID ) ); return true;
+	case ValueType::Node:			*out = std::format( "Value( &aotNodes[ {} ] )", emitter->nodes[ value.valueNode ] ); return true;
+	case ValueType::Arr:
+		{
+			// arrays folded by the optimiser
+			std::string entries;
+			for ( u64 i = 0, count = value.array_count(); i < count; ++i )
+			{
+				Value entry = value.array->packed ? Value( value.array->ints[ i ] ) : value.array->values[ i ];
+				std::string entryOut;
+				if ( !emit_value( emitter, entry, &entryOut ) )
+					return false;
+				entries += std::format( "{}{}", entries.empty() ? " " : ", ", entryOut );
+			}
+			*out = std::format( "aot_array( {{{} }} )", entries );
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::string node_ref( CppEmitter *emitter, Node *node )
+{
+	return node ? std::format( "&aotNodes[ {} ]", emitter->nodes[ node ] ) : "nullptr";
+}
+
+// Expression giving what run( node ) would
+static std::string eval( CppEmitter *emitter, Node *node )
+{
+	u32 index = emitter->nodes[ node ];
+	if ( is_translated( node ) )
+		return std::format( "aot_{}( in )", index );
+	return std::format( "in->run( &aotNodes[ {} ] )", index );
+}
+
+static const char *operator_of( TokenID id )
+{
+	switch ( id )
+	{
+	case TokenID::Minus:				return "-";
+	case TokenID::Plus:					return "+";
+	case TokenID::Divide:				return "/";
+	case TokenID::Asterisk:				return "*";
+	case TokenID::Amp:					return "&";
+	case TokenID::Pipe:					return "|";
+	case TokenID::Hat:					return "^";
+	case TokenID::Percent:				return "%";
+	case TokenID::DoubleAssign:			return "==";
+	case TokenID::ExclamationAssign:	return "!=";
+	case TokenID::GreaterThan:			return ">";
+	case TokenID::GreaterOrEqual:		return ">=";
+	case TokenID::LesserThan:			return "<";
+	case TokenID::LesserOrEqual:		return "<=";
+	case TokenID::MinusAssign:			return "-=";
+	case TokenID::PlusAssign:			return "+=";
+	case TokenID::DivideAssign:			return "/=";
+	case TokenID::AsteriskAssign:		return "*=";
+	case TokenID::AmpAssign:			return "&=";
+	case TokenID::PipeAssign:			return "|=";
+	case TokenID::HatAssign:			return "^=";
+	case TokenID::PercentAssign:		return "%=";
+	}
+	return nullptr;
+}
+
+// process_codeblock with the children unrolled
+static void emit_codeblock( CppEmitter *emitter, Node *node, u32 index )
+{
+	std::string &out = emitter->out;
+
+	out += std::format( "static Value aot_block_{}( Interpreter *in )\n{{\n", index );
+	out += "\tin->scope_push();\n\n\tValue value;\n\n";
+
+	for ( auto child : node->children )
+	{
+		if ( child->type == NodeID::Continue || child->type == NodeID::Break )
+		{
+			out += std::format( "\tin->scope_pop();\n\treturn KeywordID::{};\n}}\n\n", child->type == NodeID::Continue ? "Continue" : "Break" );
+			return;
+		}
+
+		out += std::format( "\tvalue = {};\n", eval( emitter, child ) );
+		out += "\tif ( in->returning )\n\t{\n";
+		out += "\t\tif ( value.deref().scope == in->scope )\n\t\t\tvalue.unfold();\n";
+		out += "\t\tin->scope_pop();\n\t\treturn value;\n\t}\n";
+		out += "\tif ( value.type == ValueType::Command && ( value.keywordID == KeywordID::Continue || value.keywordID == KeywordID::Break ) )\n\t{\n";
+		out += "\t\tin->scope_pop();\n\t\treturn value;\n\t}\n";
+	}
+
+	out += "\n\tin->scope_pop();\n\treturn value;\n}\n\n";
+}
+
+// breakable_codeblock with the children unrolled
+static void emit_loop_body( CppEmitter *emitter, Node *node, u32 index )
+{
+	std::string &out = emitter->out;
+
+	out += std::format( "static void aot_body_{}( Interpreter *in, bool *flagBreak, bool *flagContinue, bool *flagReturn, Value *ret )\n{{\n", index );
+	out += "\t*flagContinue = false;\n\t*flagBreak = false;\n\t*flagReturn = false;\n\n";
+
+	for ( auto child : node->children )
+	{
+		if ( child->type == NodeID::Continue || child->type == NodeID::Break )
+		{
+			out += std::format( "\t*{} = true;\n}}\n\n", child->type == NodeID::Continue ? "flagContinue" : "flagBreak" );
+			return;
+		}
+
+		out += std::format( "\t*ret = {};\n", eval( emitter, child ) );
+		out += "\tif ( in->returning )\n\t{\n";
+		out += "\t\t*flagReturn = true;\n";
+		out += "\t\tif ( ret->deref().scope == in->scope )\n\t\t\tret->unfold();\n";
+		out += "\t\tin->scope_pop();\n\t\treturn;\n\t}\n";
+		out += "\tif ( ret->type == ValueType::Command )\n\t{\n";
+		out += "\t\tif ( ret->keywordID == KeywordID::Continue ) { *flagContinue = true; return; }\n";
+		out += "\t\tif ( ret->keywordID == KeywordID::Break ) { *flagBreak = true; return; }\n\t}\n";
+	}
+
+	out += "}\n\n";
+}
+
+// Interpreter::compare with the operands translated
+static bool emit_compare( CppEmitter *emitter, Node *node, u32 index )
+{
+	const char *op = nullptr;
+
+	switch ( node->token->id )
+	{
+	case TokenID::DoubleAssign:
+	case TokenID::ExclamationAssign:
+	case TokenID::GreaterThan:
+	case TokenID::GreaterOrEqual:
+	case TokenID::LesserThan:
+	case TokenID::LesserOrEqual:
+		op = operator_of( node->token->id );
+		break;
+
+	default:
+		return false;
+	}
+
+	std::string &out = emitter->out;
+	out += std::format( "static bool aot_compare_{}( Interpreter *in )\n{{\n", index );
+	out += std::format( "\tValue lhs = {};\n\tValue rhs = {};\n", eval( emitter, node->left ), eval( emitter, node->right ) );
+	out += "\tconst Value &l = lhs.deref();\n\tconst Value &r = rhs.deref();\n\n";
+	out += std::format( "\tif ( l.type == ValueType::NumberI64 && r.type == ValueType::NumberI64 )\n\t\treturn l.valueI64 {0} r.valueI64;\n\treturn l {0} r;\n}}\n\n", op );
+	return true;
+}
+
+static bool emit_node( CppEmitter *emitter, Node *node, u32 index )
+{
+	std::string &out = emitter->out;
+	std::string body;
+
+	switch ( node->type )
+	{
+	case NodeID::Block:
+		emit_codeblock( emitter, node, index );
+		body = std::format( "\treturn aot_block_{}( in );\n", index );
+		break;
+
+	case NodeID::Identifier:
+		body = "\treturn &in->get_value( node );\n";
+		break;
+
+	case NodeID::CreateIdentifier:
+		body = "\treturn &in->get_or_create_value( node );\n";
+		break;
+
+	case NodeID::StringLiteral:
+	case NodeID::Number:
+		body = "\treturn node->value;\n";
+		break;
+
+	case NodeID::Assignment:
+		body = std::format( "\treturn {} = {};\n", eval( emitter, node->left ), eval( emitter, node->right ) );
+		break;
+
+	case NodeID::Operation:
+		{
+			const char *op = operator_of( node->token->id );
+			if ( op )
+				body = std::format( "\treturn {} {} {};\n", eval( emitter, node->left ), op, eval( emitter, node->right ) );
+			else
+				body = "\treturn Value();\n";
+		}
+		break;
+
+	case NodeID::AssignmentOp:
+		{
+			const char *op = operator_of( node->token->id );
+			if ( op )
+				body = std::format( "\tValue value = {};\n\treturn value {} {};\n", eval( emitter, node->left ), op, eval( emitter, node->right ) );
+			else
+				body = "\treturn Value();\n";
+		}
+		break;
+
+	case NodeID::AssignmentOpConst:
+		body = std::format( "\tValue value = {};\n", eval( emitter, node->left ) );
+		body += "\tValue &l = value.deref();\n\n";
+		body += "\tif ( l.type == ValueType::NumberI64 )\n\t{\n";
+		body += std::format( "\t\tl.valueI64 {} node->right->value.valueI64;\n\t\treturn value;\n\t}}\n\n", node->token->id == TokenID::PlusAssign ? "+=" : "-=" );
+		body += std::format( "\treturn value {} node->right->value;\n", node->token->id == TokenID::PlusAssign ? "+=" : "-=" );
+		break;
+
+	case NodeID::FunctionCall:
+		body = "\treturn in->call( node );\n";
+		break;
+
+	case NodeID::If:
+	case NodeID::IfCompare:
+		emit_codeblock( emitter, node, index );
+		if ( node->type == NodeID::IfCompare )
+		{
+			if ( !emit_compare( emitter, node->left, index ) )
+				return false;
+			body = std::format( "\tif ( aot_compare_{}( in ) )\n", index );
+		}
+		else
+		{
+			body = std::format( "\tif ( {}.get_as_bool( in, node ) )\n", eval( emitter, node->left ) );
+		}
+		body += std::format( "\t\treturn aot_block_{}( in );\n", index );
+		if ( node->right )
+			body += std::format( "\treturn {};\n", eval( emitter, node->right ) );
+		else
+			body += "\treturn Value();\n";
+		break;
+
+	case NodeID::Return:
+		if ( node->left && node->left->type == NodeID::FunctionCall )
+			body = std::format( "\tValue value = ( !in->callStack.empty() ? in->call( node->left, true ) : {} );\n", eval( emitter, node->left ) );
+		else if ( node->left )
+			body = std::format( "\tValue value = {};\n", eval( emitter, node->left ) );
+		else
+			body = "\tValue value = node->value;\n";
+		body += "\tin->returning = true;\n\treturn value;\n";
+		break;
+
+	case NodeID::ForNumberRange:
+		emit_loop_body( emitter, node, index );
+		body = "\tin->scope_push();\n\n";
+		body += "\tValue &v = in->get_or_create_value( node->left );\n\n";
+		body += std::format( "\ti64 start = {}.get_as_i64( in, node->right );\n", eval( emitter, node->right ) );
+		body += std::format( "\ti64 end = {}.get_as_i64( in, node->right->right );\n", eval( emitter, node->right->right ) );
+		body += "\ti64 dir = ( end - start );\n\n\tdir = ( dir < 0 ? -1 : ( dir > 0 ? 1 : 0 ) );\n\n";
+		body += "\tValue ret;\n\tbool flagBreak;\n\tbool flagContinue;\n\tbool flagReturn;\n\n";
+		body += "\tfor ( i64 i = start; true; i += dir )\n\t{\n";
+		body += "\t\tif ( v.type == ValueType::NumberI64 )\n\t\t\tv.valueI64 = i;\n\t\telse\n\t\t\tv = i;\n\n";
+		body += std::format( "\t\taot_body_{}( in, &flagBreak, &flagContinue, &flagReturn, &ret );\n\n", index );
+		body += "\t\tif ( flagReturn )\treturn ret;\n\t\tif ( i == end )\t\tbreak;\n\t\tif ( flagBreak )\tbreak;\n\t\tif ( flagContinue )\tcontinue;\n\t}\n\n";
+		body += "\tin->scope_pop();\n\treturn Value();\n";
+		break;
+
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		{
+			std::string condition;
+			emit_loop_body( emitter, node, index );
+			if ( node->type == NodeID::WhileCompare )
+			{
+				if ( !emit_compare( emitter, node->left, index ) )
+					return false;
+				condition = std::format( "aot_compare_{}( in )", index );
+			}
+			else
+			{
+				condition = std::format( "{}.get_as_bool( in, node->left )", eval( emitter, node->left ) );
+			}
+
+			body = "\tin->scope_push();\n\n";
+			body += std::format( "\tif ( {} )\n\t{{\n", condition );
+			body += "\t\tValue &idx = in->get_or_create_value( LoopIndexName );\n";
+			body += "\t\tValue ret;\n\t\tbool flagBreak;\n\t\tbool flagContinue;\n\t\tbool flagReturn;\n\t\ti32 index = 0;\n\n";
+			body += "\t\twhile ( true )\n\t\t{\n\t\t\tidx = index++;\n\n";
+			body += std::format( "\t\t\taot_body_{}( in, &flagBreak, &flagContinue, &flagReturn, &ret );\n\n", index );
+			body += "\t\t\tif ( flagReturn )\treturn ret;\n\t\t\tif ( flagBreak )\tbreak;\n\n";
+			body += std::format( "\t\t\tif ( !( {} ) )\n\t\t\t\tbreak;\n\t\t}}\n\t}}\n\n", condition );
+			body += "\tin->scope_pop();\n\treturn Value();\n";
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	out += std::format( "static Value aot_{}( Interpreter *in )\n{{\n", index );
+	out += std::format( "\tNode *node = &aotNodes[ {} ];\n\t(void)node;\n\n", index );
+	out += body;
+	out += "}\n\n";
+	return true;
+}
+
+bool CppEmitter::run( Node *root, const std::vector<std::string> &filenames, const std::string &source, const std::string &outFile )
+{
+	number_nodes( this, root );
+
+	// -- statements handed back to the interpreter through Native nodes --
+	struct Wrapper
+	{
+		u32 parent;
+		u32 position;
+		u32 child;
+	};
+
+	std::vector<Wrapper> wrappers;
+	for ( u32 index = 0, count = static_cast<u32>( order.size() ); index < count; ++index )
+	{
+		Node *node = order[ index ];
+		if ( !runs_statements( node ) )
+			continue;
+		for ( u32 position = 0; position < node->children.size(); ++position )
+		{
+			if ( is_translated( node->children[ position ] ) )
+				wrappers.push_back( { index, position, nodes[ node->children[ position ] ] } );
+		}
+	}
+
+	u64 nodeCount = order.size() + wrappers.size();
+
+	out.clear();
+	out += std::format( "// Generated by azcode --emit-cpp from {}\n", source );
+	out += "// Build it like azcode itself, with build.bat's flags and src/ on the include path.\n\n";
+	out += "#define AZCODE_AOT\n#include \"main.cpp\"\n\n";
+	out += std::format( "static Token aotTokens[ {} ];\n", std::max<u64>( tokenOrder.size(), 1 ) );
+	out += std::format( "static Node aotNodes[ {} ];\n\n", nodeCount );
+
+	for ( u32 index = 0; index < order.size(); ++index )
+	{
+		if ( is_translated( order[ index ] ) )
+			out += std::format( "static Value aot_{}( Interpreter *in );\n", index );
+	}
+	out += "\n";
+
+	for ( const Wrapper &wrapper : wrappers )
+		out += std::format( "static Value aot_native_{0}( Interpreter *in, Value &, Node * ) {{ return aot_{0}( in ); }}\n", wrapper.child );
+	out += "\n";
+
+	// -- the tree --
+	out += "static void aot_build()\n{\n";
+
+	std::string value;
+	for ( u32 index = 0; index < tokenOrder.size(); ++index )
+	{
+		Token *token = tokenOrder[ index ];
+		if ( !emit_value( this, token->value, &value ) )
+		{
+			std::println( stderr, "[Emitter] Unexpected token value type {} on line {}.", token->value.type, token->line );
+			return false;
+		}
+		out += std::format( "\taot_token( &aotTokens[ {} ], TokenID::{}, {}, {}, {} );\n", index, TokenTypes[ static_cast<i32>( token->id ) ].name, value, token->line, token->file );
+	}
+	out += "\n";
+
+	for ( u32 index = 0; index < order.size(); ++index )
+	{
+		Node *node = order[ index ];
+		if ( !emit_value( this, node->value, &value ) )
+		{
+			std::println( stderr, "[Emitter] Unexpected node value type {} in {}.", node->value.type, node->type );
+			return false;
+		}
+
+		std::string children;
+		for ( auto child : node->children )
+			children += std::format( "{}{}", children.empty() ? " " : ", ", node_ref( this, child ) );
+
+		out += std::format( "\taot_node( &aotNodes[ {} ], NodeID::{}, {}, {}, {}, {}, {}, {{{} }} );\n",
+			index,
+			NodeTypes[ static_cast<i32>( node->type ) ].name,
+			node->token ? std::format( "&aotTokens[ {} ]", tokens[ node->token ] ) : "nullptr",
+			value,
+			node_ref( this, node->left ),
+			node_ref( this, node->right ),
+			node->scope,
+			children );
+	}
+	out += "\n";
+
+	for ( u32 index = 0; index < wrappers.size(); ++index )
+	{
+		const Wrapper &wrapper = wrappers[ index ];
+		Node *child = order[ wrapper.child ];
+		u64 native = order.size() + index;
+		out += std::format( "\taot_node( &aotNodes[ {} ], NodeID::Native, {}, Value( aot_native_{} ), nullptr, nullptr, {}, {{}} );\n",
+			native,
+			child->token ? std::format( "&aotTokens[ {} ]", tokens[ child->token ] ) : "nullptr",
+			wrapper.child,
+			child->scope );
+		out += std::format( "\taotNodes[ {} ].children[ {} ] = &aotNodes[ {} ];\n", wrapper.parent, wrapper.position, native );
+	}
+	out += "}\n\n";
+
+	// -- translated nodes --
+	for ( u32 index = 0; index < order.size(); ++index )
+	{
+		Node *node = order[ index ];
+		if ( is_translated( node ) && !emit_node( this, node, index ) )
+		{
+			std::println( stderr, "[Emitter] Unable to translate {} node.", node->type );
+			return false;
+		}
+	}
+
+	// -- entry --
+	std::string files;
+	for ( const std::string &filename : filenames )
+		files += std::format( "{}{}", files.empty() ? " " : ", ", quote( filename ) );
+
+	out += "i32 main( i32 argc, char *argv[] )\n{\n";
+	out += "\taot_build();\n\n";
+	out += "\tInterpreter interpreter;\n\n";
+	out += "\tinterpreter.set_args( argc, argv );\n\n";
+	out += std::format( "\ti32 ret = interpreter.run( {{{} }}, &aotNodes[ 0 ] ).valueI32;\n\n", files );
+	out += "\tinterpreter.cleanup();\n\n";
+	out += "\tif ( ret != 0 )\n\t\tstd::println( stderr, \"ReturnCode ( {} ).\", ret );\n\n";
+	out += "\treturn ret;\n}\n";
+
+	std::ofstream file( outFile, std::ios::binary );
+	if ( !file.is_open() )
+		return false;
+	file << out;
+	return true;
+}
+
+// --------------------------------------------------------------------
+
+void aot_token( Token *token, TokenID id, const Value &value, i32 line, i32 file )
+{
+	token->id = id;
+	token->value = value;
+	token->line = line;
+	token->file = file;
+}
+
+Value aot_array( std::initializer_list<Value> entries )
+{
+	Value arr( ValueType::Arr );
+	for ( const Value &entry : entries )
+		arr.array_push( entry );
+	return arr;
+}
+
+void aot_node( Node *node, NodeID type, Token *token, const Value &value, Node *left, Node *right, i32 scope, std::initializer_list<Node*> children )
+{
+	node->type = type;
+	node->token = token;
+	node->value = value;
+	node->left = left;
+	node->right = right;
+	node->children = children;
+	node->scope = scope;
+}
@@ -0,0 +1,28 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "parser.h"
+
+// Translates a parsed program into a C++ translation unit. The tree is rebuilt
+// as static data so builtins and error messages still get their nodes, and the
+// statements that don't need the interpreter become direct calls on Value.
+struct CppEmitter
+{
+	bool run( Node *root, const std::vector<std::string> &filenames, const std::string &source, const std::string &outFile );
+
+	std::string out;
+	std::unordered_map<Node*, u32> nodes;
+	std::vector<Node*> order;
+	std::unordered_map<Token*, u32> tokens;
+	std::vector<Token*> tokenOrder;
+};
+
+// -- runtime used by the generated code --
+
+void aot_token( Token *token, TokenID id, const Value &value, i32 line, i32 file );
+Value aot_array( std::initializer_list<Value> entries );
+void aot_node( Node *node, NodeID type, Token *token, const Value &value, Node *left, Node *right, i32 scope, std::initializer_list<Node*> children );
@@ -73,37 +73,48 @@ enum class KeywordID
 	Exit,
 };
 
+// NodeID and NodeTypes are both generated from this list
+#define NODE_IDS( X ) \
+	X( Entry ) \
+	X( Block ) \
+	X( Identifier ) \
+	X( CreateIdentifier ) \
+	X( StringLiteral ) \
+	X( Number ) \
+	X( CreateStruct ) \
+	X( CreateArray ) \
+	X( ArrayAccess ) \
+	X( Assignment ) \
+	X( Operation ) \
+	X( AssignmentOp ) \
+	X( DeclFunc ) \
+	X( FunctionArgs ) \
+	X( FunctionCall ) \
+	X( If ) \
+	X( Import ) \
+	X( Return ) \
+	X( Print ) \
+	X( Println ) \
+	X( Assert ) \
+	X( ForNumberRange ) \
+	X( ForOfIdentifier ) \
+	X( ForOfIdentifierRange ) \
+	X( ForOfIdentifierRangeCount ) \
+	X( While ) \
+	X( Continue ) \
+	X( Break ) \
+	X( Exit ) \
+	X( InlinedCall ) \
+	X( AssignmentOpConst ) \
+	X( IfCompare ) \
+	X( WhileCompare ) \
+	X( Native )
+
 enum class NodeID
 {
-	Entry,
-	Block,
-	Identifier,
-	CreateIdentifier,
-	StringLiteral,
-	Number,
-	CreateStruct,
-	CreateArray,
-	ArrayAccess,
-	Assignment,
-	Operation,
-	AssignmentOp,
-	DeclFunc,
-	FunctionArgs,
-	FunctionCall,
-	If,
-	Import,
-	Return,
-	Print,
-	Println,
-	Assert,
-	ForNumberRange,
-	ForOfIdentifier,
-	ForOfIdentifierRange,
-	ForOfIdentifierRangeCount,
-	While,
-	Continue,
-	Break,
-	Exit,
+#define NODE_ID_ENUM( id ) id,
+	NODE_IDS( NODE_ID_ENUM )
+#undef NODE_ID_ENUM
 };
 
 enum class ValueType
@@ -121,4 +132,9 @@ enum class ValueType
 	Reference,
 	File,
 	Command,
+	Dict,
+	Deque,
+	Heap,
+	StrBuf,
+	Bytes,
 };
\ No newline at end of file
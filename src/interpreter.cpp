@@ -5,6 +5,8 @@
 #include "interpreter.h"
 #include "os.h"
 #include "net.h"
+#include "collections.h"
+#include "text.h"
 
 static void breakable_codeblock( Interpreter *interpreter, Node *node, bool *flagBreak, bool *flagContinue, bool *flagReturn, Value *ret )
 {
@@ -27,6 +29,15 @@ static void breakable_codeblock( Interpreter *interpreter, Node *node, bool *fla
 
 		*ret = interpreter->run( child );
 
+		if ( interpreter->returning )
+		{
+			*flagReturn = true;
+			if ( ret->deref().scope == interpreter->scope )
+				ret->unfold();
+			interpreter->scope_pop();
+			return;
+		}
+
 		if ( ret->type == ValueType::Command )
 		{
 			switch ( ret->keywordID )
@@ -40,18 +51,38 @@ static void breakable_codeblock( Interpreter *interpreter, Node *node, bool *fla
 				return;
 			}
 		}
-
-		switch ( child->type )
-		{
-		case NodeID::Return:
-			*flagReturn = true;
-			if ( ret->deref().scope == interpreter->scope )
-				ret->unfold();
-			interpreter->scope_pop();
-		}
 	}
 }
 
+// Interned the first time the node runs, so nodes the optimiser builds need nothing extra
+static const InternedString *name_of( Node *node )
+{
+	if ( !node->name )
+		node->name = intern( node->value.valueString );
+	return node->name;
+}
+
+// Writes an indexed assignment back. Nothing refers into the array while the
+// right hand side runs, so it may have grown or been cleared in the meantime.
+static void store_entry( Value &base, i64 index, const Value &value )
+{
+	Value &arr = base.deref();
+	if ( arr.type == ValueType::Arr )
+		arr.array_store( index, value );
+	else
+		arr[ index ] = value;
+}
+
+static void load_entry( Value &v, const Value &arr, u64 index )
+{
+	if ( !arr.array->packed )
+		v = arr.array->values[ index ];
+	else if ( v.type == ValueType::NumberI64 )
+		v.valueI64 = arr.array->ints[ index ];
+	else
+		v = arr.array->ints[ index ];
+}
+
 static Value process_codeblock( Interpreter *interpreter, Node *node )
 {
 	interpreter->scope_push();
@@ -63,34 +94,36 @@ static Value process_codeblock( Interpreter *interpreter, Node *node )
 		switch ( child->type )
 		{
 		case NodeID::Continue:
+			interpreter->scope_pop();
 			return KeywordID::Continue;
 
 		case NodeID::Break:
+			interpreter->scope_pop();
 			return KeywordID::Break;
 		}
 
 		value = interpreter->run( child );
 
+		if ( interpreter->returning )
+		{
+			// check if the value will go out of scope with the return
+			// it will have to pass-by-value
+			if ( value.deref().scope == interpreter->scope )
+				value.unfold();
+			interpreter->scope_pop();
+			return value;
+		}
+
 		if ( value.type == ValueType::Command )
 		{
 			switch ( value.keywordID )
 			{
 			case KeywordID::Continue:
 			case KeywordID::Break:
+				interpreter->scope_pop();
 				return value;
 			}
 		}
-
-		switch ( child->type )
-		{
-		case NodeID::Return:
-			// check if the value will go out of scope with the return
-			// it will have to pass-by-value
-			if ( value.deref().scope == interpreter->scope )
-				value.unfold();
-			interpreter->scope_pop();
-			return value;
-		}
 	}
 
 	interpreter->scope_pop();
@@ -171,11 +204,16 @@ Value Interpreter::run( std::vector<std::string> files, Node *node )
 {
 	filenames = std::move( files );
 
+	char stackMarker;
+	stackBase = &stackMarker;
+	u64 stackSpace = stack_space_below( stackBase );
+	stackBudget = ( stackSpace > NativeStackMargin * 2 ? stackSpace - NativeStackMargin : stackSpace / 2 );
+
 	builtInImports[ "args" ] = [this]()
 	{
 		Value arr( ValueType::Arr );
 		for ( auto arg : programArgs )
-			arr.arr.push_back( arg );
+			arr.array_push( arg );
 		get_or_create_global( "args" ) = arr;
 	};
 
@@ -190,8 +228,15 @@ Value Interpreter::run( std::vector<std::string> files, Node *node )
 		lwo.map[ "exists" ] = BuiltInNode_Struct_OS_Exists;
 		lwo.map[ "file_size" ] = BuiltInNode_Struct_OS_FileSize;
 		lwo.map[ "read" ] = BuiltInNode_Struct_OS_Read;
+		lwo.map[ "read_line" ] = BuiltInNode_Struct_OS_ReadLine;
+		lwo.map[ "read_until" ] = BuiltInNode_Struct_OS_ReadUntil;
+		lwo.map[ "eof" ] = BuiltInNode_Struct_OS_Eof;
 		lwo.map[ "read_file" ] = BuiltInNode_Struct_OS_ReadFile;
+		lwo.map[ "map" ] = BuiltInNode_Struct_OS_Map;
+		lwo.map[ "lines" ] = BuiltInNode_Struct_OS_Lines;
+		lwo.map[ "stdin_lines" ] = BuiltInNode_Struct_OS_StdinLines;
 		lwo.map[ "write" ] = BuiltInNode_Struct_OS_Write;
+		lwo.map[ "flush" ] = BuiltInNode_Struct_OS_Flush;
 		get_or_create_global( "os" ) = lwo;
 	};
 
@@ -212,6 +257,30 @@ Value Interpreter::run( std::vector<std::string> files, Node *node )
 		get_or_create_global( "net" ) = lwo;
 	};
 
+	builtInImports[ "collections" ] = [this]()
+	{
+		Value lwo( ValueType::Struct );
+		lwo.map[ "dict" ] = BuiltInNode_Struct_Collections_Dict;
+		lwo.map[ "deque" ] = BuiltInNode_Struct_Collections_Deque;
+		lwo.map[ "heap" ] = BuiltInNode_Struct_Collections_Heap;
+		get_or_create_global( "collections" ) = lwo;
+	};
+
+	builtInImports[ "strings" ] = [this]()
+	{
+		Value lwo( ValueType::Struct );
+		lwo.map[ "strbuf" ] = BuiltInNode_Struct_Strings_StrBuf;
+		lwo.map[ "find" ] = BuiltInNode_Struct_Strings_Find;
+		lwo.map[ "count" ] = BuiltInNode_Struct_Strings_Count;
+		lwo.map[ "split" ] = BuiltInNode_Struct_Strings_Split;
+		lwo.map[ "replace" ] = BuiltInNode_Struct_Strings_Replace;
+		lwo.map[ "starts_with" ] = BuiltInNode_Struct_Strings_StartsWith;
+		lwo.map[ "trim" ] = BuiltInNode_Struct_Strings_Trim;
+		lwo.map[ "to_upper" ] = BuiltInNode_Struct_Strings_ToUpper;
+		lwo.map[ "join" ] = BuiltInNode_Struct_Strings_Join;
+		get_or_create_global( "strings" ) = lwo;
+	};
+
 	return run( node );
 }
 
@@ -222,13 +291,16 @@ Value Interpreter::run( Node *node )
 	case NodeID::Entry:
 		{
 			scope = SCOPE_GLOBAL;
-			data.clear();
+			clear_data();
 			Value value;
 			for ( auto child : node->children )
 			{
 				value = run( child );
-				if ( child->type == NodeID::Return )
+				if ( returning )
+				{
+					returning = false;
 					return value.get_as_i64( this, child );
+				}
 			}
 			return value;
 		}
@@ -244,7 +316,8 @@ Value Interpreter::run( Node *node )
 		return &get_or_create_value( node );
 
 	case NodeID::StringLiteral:
-		return node->value;
+		// the text parsed once is shared, readers copy it only when they store it
+		return &node->value;
 
 	case NodeID::Number:
 		return node->value;
@@ -258,11 +331,11 @@ Value Interpreter::run( Node *node )
 				switch ( child->type )
 				{
 				case NodeID::DeclFunc:
-					lwo.map[ child->left->value.valueString ] = child;
+					lwo.map.get_or_add( name_of( child->left ), child->shapeCache ) = child;
 					break;
 
 				case NodeID::Assignment:
-					lwo.map[ child->left->value.valueString ] = run( child->right );
+					lwo.map.get_or_add( name_of( child->left ), child->shapeCache ) = run( child->right );
 					break;
 
 				default:
@@ -274,10 +347,14 @@ Value Interpreter::run( Node *node )
 
 	case NodeID::CreateArray:
 		{
+			// folded by the fold-arrays pass
+			if ( node->value.type == ValueType::Arr )
+				return node->value;
+
 			Value arr( ValueType::Arr );
 			// provided initialisation data
 			for ( auto child : node->children )
-				arr.arr.push_back( run( child ) );
+				arr.array_push( run( child ) );
 			return arr;
 		}
 		break;
@@ -286,80 +363,43 @@ Value Interpreter::run( Node *node )
 		return run( node->left )[ run( node->right ).get_as_i64( this, node ) ];
 
 	case NodeID::Assignment:
-		return run( node->left ) = run( node->right );
+		return assign( node, run( node->right ) );
 
 	case NodeID::Operation:
-		switch ( node->token->id )
 		{
-		case TokenID::Minus:				return run( node->left ) - run( node->right );
-		case TokenID::Plus:					return run( node->left ) + run( node->right );
-		case TokenID::Divide:				return run( node->left ) / run( node->right );
-		case TokenID::Asterisk:				return run( node->left ) * run( node->right );
-		case TokenID::Amp:					return run( node->left ) & run( node->right );
-		case TokenID::Pipe:					return run( node->left ) | run( node->right );
-		case TokenID::Hat:					return run( node->left ) ^ run( node->right );
-		case TokenID::Percent:				return run( node->left ) % run( node->right );
-		case TokenID::DoubleAssign:			return run( node->left ) == run( node->right );
-		case TokenID::ExclamationAssign:	return run( node->left ) != run( node->right );
-		case TokenID::GreaterThan:			return run( node->left ) > run( node->right );
-		case TokenID::GreaterOrEqual:		return run( node->left ) >= run( node->right );
-		case TokenID::LesserThan:			return run( node->left ) < run( node->right );
-		case TokenID::LesserOrEqual:		return run( node->left ) <= run( node->right );
+			Value lhs = run( node->left );
+			Value rhs = run( node->right );
+			return operation( node, lhs, rhs );
 		}
-		break;
 
 	case NodeID::AssignmentOp:
-		switch ( node->token->id )
+		if ( node->left->type == NodeID::ArrayAccess )
+			return assign_op_entry( node, run( node->right ) );
 		{
-		case TokenID::MinusAssign:
-			{
-				Value value = run( node->left );
-				return value -= run( node->right );
-			}
-
-		case TokenID::PlusAssign:
-			{
-				Value value = run( node->left );
-				return value += run( node->right );
-			}
-
-		case TokenID::DivideAssign:
-			{
-				Value value = run( node->left );
-				return value /= run( node->right );
-			}
-
-		case TokenID::AsteriskAssign:
-			{
-				Value value = run( node->left );
-				return value *= run( node->right );
-			}
-
-		case TokenID::AmpAssign:
-			{
-				Value value = run( node->left );
-				return value &= run( node->right );
-			}
-
-		case TokenID::PipeAssign:
-			{
-				Value value = run( node->left );
-				return value |= run( node->right );
-			}
+			Value value = run( node->left );
+			return assign_op( node, std::move( value ), run( node->right ) );
+		}
 
-		case TokenID::HatAssign:
-			{
-				Value value = run( node->left );
-				return value ^= run( node->right );
-			}
+	case NodeID::AssignmentOpConst:
+		{
+			bool entry = ( node->left->type == NodeID::ArrayAccess );
+			i64 index = 0;
+			Value base = entry ? run_entry( node->left, &index ) : Value();
+			Value value = entry ? base.deref()[ index ].deref() : run( node->left );
+			Value &l = value.deref();
+			i64 constant = node->right->value.valueI64;
+
+			if ( l.type == ValueType::NumberI64 )
+				l.valueI64 += ( node->token->id == TokenID::PlusAssign ? constant : -constant );
+			else if ( node->token->id == TokenID::PlusAssign )
+				value += node->right->value;
+			else
+				value -= node->right->value;
 
-		case TokenID::PercentAssign:
-			{
-				Value value = run( node->left );
-				return value %= run( node->right );
-			}
+			if ( entry )
+				store_entry( base, index, value );
+			return value;
 		}
-		break;
 
 	case NodeID::DeclFunc:
 		get_or_create_value( node->left ) = node;
@@ -369,67 +409,36 @@ Value Interpreter::run( Node *node )
 		break;
 
 	case NodeID::FunctionCall:
-		{
-			chainedDotAccess = nullptr;
-
-			Value ret = run( node->left );
-			Value &call = ret.deref();
+		return call( node );
 
-			if ( call.type == ValueType::Node )
-			{
-				Node *funcNode = call.valueNode;
-				if ( funcNode )
-				{
-					if ( ( funcNode->right ? funcNode->right->children.size() : 0 ) != node->children.size() )
-					{
-						u64 wanted = ( funcNode->right ? funcNode->right->children.size() : 0 );
-						fatal( RESULT_CODE_FUNCTION_ARG_COUNT, node, "Function wants {} args, but was given {} args.", wanted, node->children.size() );
-					}
+	case NodeID::InlinedCall:
+		{
+			// The inlined expression stands in for the call while the callee
+			// is still the function it was taken from
+			Node *callNode = node->left;
 
-					scope_push( chainedDotAccess );
+			chainedDotAccess = nullptr;
 
-					// -- setup arguments --
-					for ( u64 argIdx = 0, argCount = node->children.size(); argIdx < argCount; ++argIdx )
-					{
-						Node *argNode = funcNode->right->children[ argIdx ];
-						get_or_create_value( data[ argNode->value.valueString ], scope, argNode ) = run( node->children[ argIdx ] );
-					}
+			Value ret = run( callNode->left );
+			Value &callee = ret.deref();
 
-					// -- process the codeblock of the function --
-					for ( auto child : funcNode->children )
-					{
-						Value value = run( child );
+			if ( callee.type != ValueType::Node || callee.valueNode != node->value.valueNode )
+				return call( callNode );
 
-						if ( child->type == NodeID::Return )
-						{
-							// check if the value will go out of scope with the return
-							// it will have to pass-by-value
-							if ( value.deref().scope == scope )
-								value.unfold();
-							scope_pop();
-							return value;
-						}
-					}
+			context.push_back( chainedDotAccess );
+			Value value = run( node->right );
+			context.pop_back();
 
-					scope_pop();
-				}
-			}
-			else if ( call.type == ValueType::InbuiltFunc )
-			{
-				scope_push( chainedDotAccess );
-				Value inbuiltReturn = call.valueInbuiltFunc( this, *context.back(), node );
-				scope_pop();
-				return inbuiltReturn;
-			}
-			else
-			{
-				fatal( RESULT_CODE_NOT_CALLABLE, node, "Not callable \"{}\"", node->left->value.valueString );
-			}
+			value.unfold();
+			return value;
 		}
 
 	case NodeID::If:
+	case NodeID::IfCompare:
 		{
-			if ( run( node->left ).get_as_bool( this, node ) )
+			bool taken = ( node->type == NodeID::IfCompare ? compare( node->left ) : run( node->left ).get_as_bool( this, node ) );
+
+			if ( taken )
 			{
 				return process_codeblock( this, node );
 			}
@@ -455,9 +464,13 @@ Value Interpreter::run( Node *node )
 		break;
 
 	case NodeID::Return:
-		if ( node->left )
-			return run( node->left );
-		return node->value;
+		{
+			// The callee of a returned call can take over the current frame
+			bool tail = ( node->left && node->left->type == NodeID::FunctionCall && !callStack.empty() );
+			Value value = ( tail ? call( node->left, true ) : ( node->left ? run( node->left ) : node->value ) );
+			returning = true;
+			return value;
+		}
 
 	case NodeID::Print:
 		{
@@ -527,19 +540,37 @@ Value Interpreter::run( Node *node )
 			bool flagBreak;
 			bool flagContinue;
 			bool flagReturn;
+			JitRegion *region = ( jit.enabled ? jit.region( node ) : nullptr );
 
 			for ( i64 i = start; true; i += dir )
 			{
-				v = i;
+				// on-stack replacement, native code runs the remaining iterations
+				i64 loop[ 3 ] = { i, end, dir };
+				if ( region && jit_enter( node, region, loop, &ret ) )
+				{
+					scope_pop();
+					return ret;
+				}
+
+				// only a full assignment when the body changed the variable type
+				if ( v.type == ValueType::NumberI64 )
+					v.valueI64 = i;
+				else
+					v = i;
 
 				breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
+				if ( flagReturn )
+				{
+					jit_verify( node, region, true, ret );
+					return ret;
+				}
 				if ( i == end )		break;
 				if ( flagBreak )	break;
 				if ( flagContinue )	continue;
-				if ( flagReturn )	return ret;
 			}
 
+			jit_verify( node, region, false, ret );
 			scope_pop();
 		}
 		break;
@@ -549,8 +580,9 @@ Value Interpreter::run( Node *node )
 			scope_push();
 
 			Value &v = get_or_create_value( node->left );
-			Value &idx = get_or_create_value( "lidx" );
-			Value identifier = run( node->right );
+			Value &idx = get_or_create_value( LoopIndexName );
+			ArenaMark arenaMark{ this, arenaTop };
+			Value identifier = loop_source( node->right );
 			Value &id = identifier.deref();
 
 			Value ret;
@@ -562,16 +594,17 @@ Value Interpreter::run( Node *node )
 			{
 				i64 index = 0;
 
-				for ( auto &entry : id.arr )
+				// by position, the body may unpack the array or grow it
+				for ( u64 at = 0; at < id.array_count(); ++at )
 				{
-					v = entry;
+					load_entry( v, id, at );
 					idx = index;
 
 					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
+					if ( flagReturn )	return ret;
 					if ( flagBreak )	break;
 					if ( flagContinue )	continue;
-					if ( flagReturn )	return ret;
 
 					index += 1;
 				}
@@ -580,11 +613,12 @@ Value Interpreter::run( Node *node )
 			{
 				i64 index = 0;
 
+				v.clear();
 				v.type = ValueType::Struct;
 				Value &key = v.map[ "key" ];
 				Value &value = v.map[ "value" ];
 
-				for ( auto &entry : id.map )
+				for ( auto entry : id.map )
 				{
 					key = entry.first;
 					value = entry.second;
@@ -592,9 +626,126 @@ Value Interpreter::run( Node *node )
 
 					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
+					if ( flagReturn )	return ret;
+					if ( flagBreak )	break;
+					if ( flagContinue )	continue;
+
+					index += 1;
+				}
+			}
+			else if ( id.type == ValueType::Dict )
+			{
+				// held here in case the body assigns something else to the variable
+				Value held = id;
+				Dict &dict = static_cast<Dict &>( *held.collection );
+				i64 index = 0;
+
+				v.clear();
+				v.type = ValueType::Struct;
+				Value &key = v.map[ "key" ];
+				Value &value = v.map[ "value" ];
+
+				for ( u64 at = 0; at < dict.count(); ++at )
+				{
+					key = dict.key_at( at );
+					value = dict.value_at( at );
+					idx = index;
+
+					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
+
+					if ( flagReturn )	return ret;
+					if ( flagBreak )	break;
+					if ( flagContinue )	continue;
+
+					index += 1;
+				}
+			}
+			else if ( id.type == ValueType::Deque )
+			{
+				Value held = id;
+				Deque &deque = static_cast<Deque &>( *held.collection );
+				i64 index = 0;
+
+				// front to back by position, the body may push or pop
+				for ( u64 at = 0; at < deque.count(); ++at )
+				{
+					v = deque.at( at );
+					idx = index;
+
+					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
+
+					if ( flagReturn )	return ret;
+					if ( flagBreak )	break;
+					if ( flagContinue )	continue;
+
+					index += 1;
+				}
+			}
+			else if ( id.type == ValueType::File )
+			{
+				// held here in case the body assigns over the variable
+				FileId fileId = id.fileId;
+				FileHandle *file = fileTable.get( fileId );
+				if ( !file )
+					fatal( RESULT_CODE_VALUE_NOT_A_FILE, "Loop over a closed file. {}", fail_at( node ) );
+				if ( file->buffer.size() < LineBufferSize )
+					file->buffer.resize( LineBufferSize );
+				i64 index = 0;
+				flagReturn = false;
+
+				// by line, read into the loop variable's own string, until the
+				// file ends or the body closes it
+				for ( ;; )
+				{
+					file = fileTable.get( fileId );
+					if ( !file )
+						break;
+					if ( v.type != ValueType::StringLiteral )
+						v = "";
+					if ( !file->read_line( v.valueString ) )
+						break;
+					idx = index;
+
+					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
+
+					if ( flagReturn )	break;
 					if ( flagBreak )	break;
 					if ( flagContinue )	continue;
+
+					index += 1;
+				}
+
+				// a file from os.lines has no other owner to close it
+				file = fileTable.get( fileId );
+				if ( file && file->closeAtEnd )
+					fileTable.close( fileId );
+				if ( flagReturn )
+					return ret;
+			}
+			else if ( id.type == ValueType::Bytes )
+			{
+				Value held = id;
+				const ByteView &bytes = static_cast<const ByteView &>( *held.collection );
+				std::string_view line;
+				u64 at = 0;
+				i64 index = 0;
+
+				// by line, each a view of the same mapping. The last line's view is
+				// pointed at the next one unless the body kept hold of it, or it
+				// views another mapping it would otherwise keep alive instead.
+				while ( bytes.next_line( at, line ) )
+				{
+					if ( v.type == ValueType::Bytes && v.collection->refs == 1 && static_cast<ByteView &>( *v.collection ).mapping == bytes.mapping )
+						static_cast<ByteView &>( *v.collection ).bytes = line;
+					else
+						v = bytes_value( bytes.mapping, line );
+					idx = index;
+
+					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
+
 					if ( flagReturn )	return ret;
+					if ( flagBreak )	break;
+					if ( flagContinue )	continue;
 
 					index += 1;
 				}
@@ -613,8 +764,9 @@ Value Interpreter::run( Node *node )
 			scope_push();
 
 			Value &v = get_or_create_value( node->left );
-			Value &idx = get_or_create_value( "lidx" );
-			Value identifier = run( node->right );
+			Value &idx = get_or_create_value( LoopIndexName );
+			ArenaMark arenaMark{ this, arenaTop };
+			Value identifier = loop_source( node->right );
 			Value &id = identifier.deref();
 
 			Node *startNode = node->right->right;
@@ -635,20 +787,20 @@ Value Interpreter::run( Node *node )
 			{
 				for ( i64 i = start; true; i += dir )
 				{
-					if ( i < 0 || i >= static_cast<i64>( id.arr.size() ) )
+					if ( i < 0 || i >= static_cast<i64>( id.array_count() ) )
 					{
 						fatal( RESULT_CODE_VARIABLE_UNKNOWN, "Loop index out of bounds. {}", fail_at( node ) );
 					}
 
-					v = id.arr[ i ];
+					load_entry( v, id, i );
 					idx = i;
 
 					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
+					if ( flagReturn )	return ret;
 					if ( i == end )		break;
 					if ( flagBreak )	break;
 					if ( flagContinue )	continue;
-					if ( flagReturn )	return ret;
 				}
 			}
 			else
@@ -665,8 +817,9 @@ Value Interpreter::run( Node *node )
 			scope_push();
 
 			Value &v = get_or_create_value( node->left );
-			Value &idx = get_or_create_value( "lidx" );
-			Value identifier = run( node->right );
+			Value &idx = get_or_create_value( LoopIndexName );
+			ArenaMark arenaMark{ this, arenaTop };
+			Value identifier = loop_source( node->right );
 			Value &id = identifier.deref();
 
 			Node *startNode = node->right->right;
@@ -684,19 +837,19 @@ Value Interpreter::run( Node *node )
 			{
 				for ( i64 i = start; i < end; ++i )
 				{
-					if ( i < 0 || i >= static_cast<i64>( id.arr.size() ) )
+					if ( i < 0 || i >= static_cast<i64>( id.array_count() ) )
 					{
 						fatal( RESULT_CODE_VARIABLE_UNKNOWN, "Loop index out of bounds. {}", fail_at( node ) );
 					}
 
-					v = id.arr[ i ];
+					load_entry( v, id, i );
 					idx = i;
 
 					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
+					if ( flagReturn )	return ret;
 					if ( flagBreak )	break;
 					if ( flagContinue )	continue;
-					if ( flagReturn )	return ret;
 				}
 			}
 			else
@@ -709,17 +862,21 @@ Value Interpreter::run( Node *node )
 		break;
 
 	case NodeID::While:
+	case NodeID::WhileCompare:
 		{
 			scope_push();
 
-			if ( run( node->left ).get_as_bool( this, node->left ) )
+			bool fused = ( node->type == NodeID::WhileCompare );
+
+			if ( fused ? compare( node->left ) : run( node->left ).get_as_bool( this, node->left ) )
 			{
-				Value &idx = get_or_create_value( "lidx" );
+				Value &idx = get_or_create_value( LoopIndexName );
 				Value ret;
 				bool flagBreak;
 				bool flagContinue;
 				bool flagReturn;
 				i32 index = 0;
+				JitRegion *region = ( jit.enabled ? jit.region( node ) : nullptr );
 
 				while ( true )
 				{
@@ -727,26 +884,398 @@ Value Interpreter::run( Node *node )
 
 					breakable_codeblock( this, node, &flagBreak, &flagContinue, &flagReturn, &ret );
 
-					if ( !run( node->left ).get_as_bool( this, node->left ) )
+					if ( flagReturn )
+					{
+						jit_verify( node, region, true, ret );
+						return ret;
+					}
+					if ( flagBreak )	break;
+
+					// on-stack replacement, native code runs the remaining iterations
+					if ( region && jit_enter( node, region, nullptr, &ret ) )
+					{
+						if ( returning )
+						{
+							scope_pop();
+							return ret;
+						}
 						break;
+					}
 
-					if ( flagBreak )	break;
-					if ( flagContinue )	continue;
-					if ( flagReturn )	return ret;
+					if ( !( fused ? compare( node->left ) : run( node->left ).get_as_bool( this, node->left ) ) )
+						break;
 				}
 
-				scope_pop();
+				jit_verify( node, region, false, ret );
 			}
+
+			scope_pop();
 		}
 		break;
 
+	case NodeID::Continue:
+	case NodeID::Break:
+		break;
+
 	case NodeID::Exit:
 		exit( static_cast<i32>( run( node->left ).get_as_i64( this, node->left ) ) );
+
+	case NodeID::Native:
+		// statement translated by --emit-cpp, see emit_cpp.cpp
+		return node->value.valueInbuiltFunc( this, node->value, node );
+	}
+
+	return Value();
+}
+
+bool Interpreter::compare( Node *node )
+{
+	Value lhs = run( node->left );
+	Value rhs = run( node->right );
+	const Value &l = lhs.deref();
+	const Value &r = rhs.deref();
+
+	if ( l.type == ValueType::NumberI64 && r.type == ValueType::NumberI64 )
+	{
+		switch ( node->token->id )
+		{
+		case TokenID::DoubleAssign:			return l.valueI64 == r.valueI64;
+		case TokenID::ExclamationAssign:	return l.valueI64 != r.valueI64;
+		case TokenID::GreaterThan:			return l.valueI64 > r.valueI64;
+		case TokenID::GreaterOrEqual:		return l.valueI64 >= r.valueI64;
+		case TokenID::LesserThan:			return l.valueI64 < r.valueI64;
+		case TokenID::LesserOrEqual:		return l.valueI64 <= r.valueI64;
+		}
 	}
 
+	switch ( node->token->id )
+	{
+	case TokenID::DoubleAssign:			return l == r;
+	case TokenID::ExclamationAssign:	return l != r;
+	case TokenID::GreaterThan:			return l > r;
+	case TokenID::GreaterOrEqual:		return l >= r;
+	case TokenID::LesserThan:			return l < r;
+	case TokenID::LesserOrEqual:		return l <= r;
+	}
+
+	fatal( RESULT_CODE_UNEXPECTED_TOKEN, node, "Unexpected comparison \"{}\"", node->token->id );
+}
+
+// Applies an Operation node to operands that have already run
+Value Interpreter::operation( Node *node, const Value &lhs, const Value &rhs )
+{
+	// operands the type pass proved to be i64 skip the type pair switch
+	if ( node->left->staticType == ValueType::NumberI64 && node->right->staticType == ValueType::NumberI64 )
+	{
+		i64 l = lhs.deref().valueI64;
+		i64 r = rhs.deref().valueI64;
+
+		switch ( node->token->id )
+		{
+		case TokenID::Minus:				return l - r;
+		case TokenID::Plus:					return l + r;
+		case TokenID::Divide:				return l / r;
+		case TokenID::Asterisk:				return l * r;
+		case TokenID::Amp:					return l & r;
+		case TokenID::Pipe:					return l | r;
+		case TokenID::Hat:					return l ^ r;
+		case TokenID::Percent:				return l % r;
+		case TokenID::DoubleAssign:			return static_cast<i32>( l == r );
+		case TokenID::ExclamationAssign:	return static_cast<i32>( l != r );
+		case TokenID::GreaterThan:			return static_cast<i32>( l > r );
+		case TokenID::GreaterOrEqual:		return static_cast<i32>( l >= r );
+		case TokenID::LesserThan:			return static_cast<i32>( l < r );
+		case TokenID::LesserOrEqual:		return static_cast<i32>( l <= r );
+		}
+		return Value();
+	}
+
+	// proven strings compare their text directly, the other operators
+	// read numbers out of the text and stay with the type pair switch
+	if ( node->left->staticType == ValueType::StringLiteral && node->right->staticType == ValueType::StringLiteral &&
+		( node->token->id == TokenID::DoubleAssign || node->token->id == TokenID::ExclamationAssign ) )
+	{
+		bool equal = lhs.deref().valueString == rhs.deref().valueString;
+		return static_cast<i32>( node->token->id == TokenID::DoubleAssign ? equal : !equal );
+	}
+
+	switch ( node->token->id )
+	{
+	case TokenID::Minus:				return lhs - rhs;
+	case TokenID::Plus:					return lhs + rhs;
+	case TokenID::Divide:				return lhs / rhs;
+	case TokenID::Asterisk:				return lhs * rhs;
+	case TokenID::Amp:					return lhs & rhs;
+	case TokenID::Pipe:					return lhs | rhs;
+	case TokenID::Hat:					return lhs ^ rhs;
+	case TokenID::Percent:				return lhs % rhs;
+	case TokenID::DoubleAssign:			return lhs == rhs;
+	case TokenID::ExclamationAssign:	return lhs != rhs;
+	case TokenID::GreaterThan:			return lhs > rhs;
+	case TokenID::GreaterOrEqual:		return lhs >= rhs;
+	case TokenID::LesserThan:			return lhs < rhs;
+	case TokenID::LesserOrEqual:		return lhs <= rhs;
+	}
 	return Value();
 }
 
+// Stores a right hand side that has already run into the assignment's target
+Value Interpreter::assign( Node *node, Value value )
+{
+	if ( node->left->type == NodeID::ArrayAccess )
+	{
+		i64 index;
+		Value base = run_entry( node->left, &index );
+		store_entry( base, index, value );
+		return value;
+	}
+	return run( node->left ) = std::move( value );
+}
+
+// Applies an AssignmentOp to the value its target ran to
+Value Interpreter::assign_op( Node *node, Value value, const Value &rhs )
+{
+	if ( node->left->staticType == ValueType::NumberI64 && node->right->staticType == ValueType::NumberI64 )
+	{
+		Value &l = value.deref();
+		i64 r = rhs.deref().valueI64;
+
+		switch ( node->token->id )
+		{
+		case TokenID::MinusAssign:		l.valueI64 -= r; return value;
+		case TokenID::PlusAssign:		l.valueI64 += r; return value;
+		case TokenID::DivideAssign:		l.valueI64 /= r; return value;
+		case TokenID::AsteriskAssign:	l.valueI64 *= r; return value;
+		case TokenID::AmpAssign:		l.valueI64 &= r; return value;
+		case TokenID::PipeAssign:		l.valueI64 |= r; return value;
+		case TokenID::HatAssign:		l.valueI64 ^= r; return value;
+		case TokenID::PercentAssign:	l.valueI64 %= r; return value;
+		}
+		return Value();
+	}
+
+	switch ( node->token->id )
+	{
+	case TokenID::MinusAssign:		value -= rhs; break;
+	case TokenID::PlusAssign:		value += rhs; break;
+	case TokenID::DivideAssign:		value /= rhs; break;
+	case TokenID::AsteriskAssign:	value *= rhs; break;
+	case TokenID::AmpAssign:		value &= rhs; break;
+	case TokenID::PipeAssign:		value |= rhs; break;
+	case TokenID::HatAssign:		value ^= rhs; break;
+	case TokenID::PercentAssign:	value %= rhs; break;
+	default:						return Value();
+	}
+
+	return value;
+}
+
+// An AssignmentOp on an indexed target, the target runs after the right hand side
+Value Interpreter::assign_op_entry( Node *node, const Value &rhs )
+{
+	i64 index;
+	Value base = run_entry( node->left, &index );
+	Value value = base.deref()[ index ].deref();
+
+	switch ( node->token->id )
+	{
+	case TokenID::MinusAssign:		value -= rhs; break;
+	case TokenID::PlusAssign:		value += rhs; break;
+	case TokenID::DivideAssign:		value /= rhs; break;
+	case TokenID::AsteriskAssign:	value *= rhs; break;
+	case TokenID::AmpAssign:		value &= rhs; break;
+	case TokenID::PipeAssign:		value |= rhs; break;
+	case TokenID::HatAssign:		value ^= rhs; break;
+	case TokenID::PercentAssign:	value %= rhs; break;
+	default:						return Value();
+	}
+
+	store_entry( base, index, value );
+	return value;
+}
+
+// Hands the rest of a hot loop or function body to native code. Returns false
+// and leaves the interpreter to it when the region isn't compiled or a guard
+// fails, and in differential mode, where jit_verify checks the native result
+// once the interpreter gets there too.
+bool Interpreter::jit_enter( Node *node, JitRegion *region, i64 *loop, Value *ret )
+{
+	if ( region->state == JitState::Failed || region->verifying )
+		return false;
+
+	if ( region->state == JitState::Counting )
+	{
+		auto type_of = [ this ]( Node *name )
+		{
+			Value *value = get_value_if_exists( name );
+			return value ? value->type : ValueType::Undefined;
+		};
+		if ( ++region->hotness < jit.threshold || !jit.compile( region, node, type_of ) )
+			return false;
+	}
+
+	// -- guards, every variable exists and holds the type it was compiled for --
+	u64 named = region->names.size();
+	region->values.clear();
+	for ( u64 i = 0; i < named; ++i )
+	{
+		Value *value = get_value_if_exists( region->names[ i ] );
+		if ( !value || value->type != region->types[ i ] )
+		{
+			if ( ++region->guardFailures >= JitMaxGuardFailures )
+				region->state = JitState::Failed;
+			return false;
+		}
+		region->values.push_back( value );
+	}
+
+	jitSlots.resize( region->temporaries + named );
+	i64 *slots = jitSlots.data() + region->temporaries;
+	for ( u64 i = 0; i < named; ++i )
+	{
+		const Value *value = region->values[ i ];
+		slots[ i ] = ( value->type == ValueType::NumberI32 ? value->valueI32 : value->valueI64 );
+	}
+	if ( loop )
+	{
+		for ( i32 i = 0; i < 3; ++i )
+			slots[ region->loopSlot + i ] = loop[ i ];
+	}
+
+	i64 result = 0;
+	i32 status = region->entry( slots, &result );
+
+	if ( jit.differential )
+	{
+		region->expected.assign( slots, slots + named );
+		region->expectedStatus = status;
+		region->expectedResult = result;
+		region->verifying = true;
+		region->verifyDepth = callStack.size();
+		return false;
+	}
+
+	for ( u64 i = 0; i < named; ++i )
+	{
+		Value *value = region->values[ i ];
+		if ( value->type == ValueType::NumberI32 )
+			value->valueI32 = static_cast<i32>( slots[ i ] );
+		else
+			value->valueI64 = slots[ i ];
+	}
+
+	if ( status != JIT_STATUS_DONE )
+	{
+		*ret = ( status == JIT_STATUS_RETURN_I64 ? Value( result ) : Value( static_cast<i32>( result ) ) );
+		returning = true;
+	}
+
+	return true;
+}
+
+void Interpreter::jit_verify( Node *node, JitRegion *region, bool returned, const Value &ret )
+{
+	if ( !region || !region->verifying || region->verifyDepth != callStack.size() )
+		return;
+
+	region->verifying = false;
+
+	for ( u64 i = 0, count = region->values.size(); i < count; ++i )
+	{
+		const Value *value = region->values[ i ];
+		i64 number = ( value->type == ValueType::NumberI32 ? value->valueI32 : value->valueI64 );
+		if ( value->type != region->types[ i ] || number != region->expected[ i ] )
+			fatal( RESULT_CODE_JIT_MISMATCH, node, "JIT mismatch, \"{}\" is {} but native code gave {}", region->names[ i ]->value.valueString, *value, region->expected[ i ] );
+	}
+
+	if ( returned != ( region->expectedStatus != JIT_STATUS_DONE ) )
+		fatal( RESULT_CODE_JIT_MISMATCH, node, "JIT mismatch, native code {} return", returned ? "did not" : "did" );
+
+	if ( returned )
+	{
+		const Value &value = ret.deref();
+		ValueType type = ( region->expectedStatus == JIT_STATUS_RETURN_I64 ? ValueType::NumberI64 : ValueType::NumberI32 );
+		i64 result = ( value.type == ValueType::NumberI32 ? value.valueI32 : value.valueI64 );
+		if ( value.type != type || result != region->expectedResult )
+			fatal( RESULT_CODE_JIT_MISMATCH, node, "JIT mismatch, returned {} but native code gave {}", value, region->expectedResult );
+	}
+}
+
+Value Interpreter::call( Node *node, bool tail )
+{
+	chainedDotAccess = nullptr;
+
+	Value ret = run( node->left );
+	Value &callee = ret.deref();
+
+	if ( callee.type == ValueType::InbuiltFunc )
+	{
+		scope_push( chainedDotAccess );
+		Value inbuiltReturn = callee.valueInbuiltFunc( this, *context.back(), node );
+		scope_pop();
+		return inbuiltReturn;
+	}
+
+	if ( callee.type != ValueType::Node )
+		fatal( RESULT_CODE_NOT_CALLABLE, node, "Not callable \"{}\"", node->left->value.valueString );
+
+	Node *funcNode = callee.valueNode;
+	if ( !funcNode )
+		return Value();
+
+	Value *callContext = chainedDotAccess;
+	CallSite *callSite = get_call_site( node, funcNode );
+
+	// A tail call leaves the caller frame to unwind first, the arguments are
+	// bound afterwards in the callee's scope as invoke binds them
+	if ( tail && tail_safe( callContext ) )
+	{
+		tailCall = node;
+		tailFunc = funcNode;
+		tailContext = callContext;
+		return Value();
+	}
+
+	return invoke( node, funcNode, callSite, callContext, nullptr );
+}
+
+// Scoping is dynamic, so the callee of a tail call could read any variable
+// its caller made. Only a caller frame without parameters or locals is handed
+// over, and a method's context has to hang off a variable the caller's caller
+// can still see.
+bool Interpreter::tail_safe( Value *callContext ) const
+{
+	i32 baseScope = callStack.back().baseScope;
+	for ( i32 frameScope = baseScope + 1; frameScope <= scope; ++frameScope )
+	{
+		if ( !scopeWatch[ frameScope - 1 ].empty() )
+			return false;
+	}
+	return !callContext || chainedScope <= baseScope;
+}
+
+// Runs a script function from native code. Arguments are the call node's
+// expressions, or values already evaluated by a builtin calling back into
+// script. The calls the function makes push frames in run_frames, only
+// entries from native code nest on the native stack.
+Value Interpreter::invoke( Node *node, Node *funcNode, CallSite *callSite, Value *callContext, const Value *args )
+{
+	u64 argCount = node->children.size();
+
+	char stackMarker;
+	if ( callStack.size() >= MaxCallDepth || static_cast<u64>( stackBase - &stackMarker ) > stackBudget )
+		fatal( RESULT_CODE_CALL_DEPTH_EXCEEDED, node, "Call depth exceeded at {} frames.", callStack.size() );
+
+	callStack.push_back( { node, funcNode, callSite, nullptr, scope, vmLoops.size(), nullptr, 0, nullptr, nullptr } );
+	scope_push( callContext );
+
+	// -- setup arguments --
+	for ( u64 argIdx = 0; argIdx < argCount; ++argIdx )
+		get_or_create_value( *callSite->argSlots[ argIdx ], scope ) = ( args ? args[ argIdx ] : run( node->children[ argIdx ] ) );
+
+	return run_frames();
+}
+
 Value *Interpreter::chain_access( Node *node, Value *value )
 {
 	if ( value->type == ValueType::Undefined )
@@ -758,17 +1287,37 @@ Value *Interpreter::chain_access( Node *node, Value *value )
 	{
 		Value &l = value->deref();
 
-		auto subIter = l.map.find( child->value.valueString );
+		Value *field = l.map.find( name_of( child ), child->shapeCache );
+		bool builtin = !field;
+		if ( !field && child->method && child->methodType == l.type )
+		{
+			field = child->method;
+		}
+		else if ( !field )
+		{
+			// method tables are built once and never change, so the entry
+			// found for a type stays good for the site
+			StructMap *methods = builtin_methods( l.type );
+			if ( methods )
+				field = methods->find( child->value.valueString );
+			if ( field )
+			{
+				child->method = field;
+				child->methodType = l.type;
+			}
+		}
 
-		if ( subIter == l.map.end() )
+		if ( !field )
 		{
 			fatal( RESULT_CODE_VARIABLE_UNKNOWN, "\"{}\" is not a variable in \"{}\". {}", child->value.valueString, from, fail_at( child ) );
 		}
 
 		chainedDotAccess = value;
-		value = &subIter->second;
+		value = field;
 		from = child->value.valueString.c_str();
-		value->scope = scope;
+		// builtin methods live in tables shared by every interpreter and scope
+		if ( !builtin )
+			value->scope = scope;
 	}
 
 	return value;
@@ -782,18 +1331,14 @@ Value *Interpreter::get_value_if_exists( Node *node )
 		return chain_access( node, &value );
 	}
 
-	auto iter = data.find( node->value.valueString );
-	if ( iter != data.end() )
+	std::vector<Value*> &values = get_slot( node );
+	for ( i32 scopeIdx = std::min( scope, static_cast<i32>( values.size() ) - 1 ); scopeIdx >= 0; --scopeIdx )
 	{
-		std::vector<Value*> &values = iter->second;
-		for ( i32 scopeIdx = std::min( scope, static_cast<i32>( values.size() ) - 1 ); scopeIdx >= 0; --scopeIdx )
+		if ( values[ scopeIdx ] )
 		{
-			if ( values[ scopeIdx ] )
-			{
-				Value *value = chain_access( node, values[ scopeIdx ] );
-				if ( value )
-					return value;
-			}
+			Value *value = chain_access( node, values[ scopeIdx ] );
+			if ( value )
+				return value;
 		}
 	}
 
@@ -802,8 +1347,10 @@ Value *Interpreter::get_value_if_exists( Node *node )
 
 Value &Interpreter::get_value( Node *node )
 {
-	if ( node->value.valueString == "self" )
+	if ( name_of( node ) == SelfName )
 	{
+		// the context came in with the call, from the scope it was made in
+		chainedScope = scope - 1;
 		Value *chainedValue = chain_access( node, context.back() );
 		if ( chainedValue )
 			return *chainedValue;
@@ -813,31 +1360,29 @@ Value &Interpreter::get_value( Node *node )
 	if ( node->left )
 	{
 		Value value = run( node->left );
+		chainedScope = scope;
 		Value *chainedValue = chain_access( node, &value );
 		if ( chainedValue )
 			return *chainedValue;
 		fatal( RESULT_CODE_VARIABLE_UNKNOWN, "Variable unknown \"{}\" {}", node->left->value.valueString, fail_at( node->left ) );
 	}
 
-	auto iter = data.find( node->value.valueString );
-	if ( iter != data.end() )
+	std::vector<Value*> &values = get_slot( node );
+	for ( i32 scopeIdx = std::min( scope, static_cast<i32>( values.size() ) - 1 ); scopeIdx >= 0; --scopeIdx )
 	{
-		std::vector<Value*> &values = iter->second;
-		for ( i32 scopeIdx = std::min( scope, static_cast<i32>( values.size() ) - 1 ); scopeIdx >= 0; --scopeIdx )
+		if ( values[ scopeIdx ] )
 		{
-			if ( values[ scopeIdx ] )
-			{
-				Value *value = chain_access( node, values[ scopeIdx ] );
-				if ( value )
-					return *value;
-			}
+			chainedScope = scopeIdx;
+			Value *value = chain_access( node, values[ scopeIdx ] );
+			if ( value )
+				return *value;
 		}
 	}
 
 	fatal( RESULT_CODE_VARIABLE_UNKNOWN, "Variable unknown \"{}\" {}", node->value.valueString, fail_at( node ) );
 }
 
-Value &Interpreter::get_or_create_value( const char *name )
+Value &Interpreter::get_or_create_value( const InternedString *name )
 {
 	std::vector<Value*> &values = data[ name ];
 	for ( i32 i = 0, count = ( scope + 1 ) - static_cast<i32>( values.size() ); i < count; ++i )
@@ -845,25 +1390,25 @@ Value &Interpreter::get_or_create_value( const char *name )
 	Value *value = values[ scope ];
 	if ( value )
 		return *value;
-	value = new Value;
+	value = new_value();
 	value->scope = scope;
 	if ( scope > 0 )
-		scopeWatch[ scope - 1 ].push_back( name );
+		scopeWatch[ scope - 1 ].push_back( &values );
 	values[ scope ] = value;
 	return *value;
 }
 
-Value &Interpreter::get_or_create_value( std::vector<Value*> &values, i32 valueScope, Node *node )
+Value &Interpreter::get_or_create_value( std::vector<Value*> &values, i32 valueScope )
 {
 	for ( i32 i = 0, count = ( valueScope + 1 ) - static_cast<i32>( values.size() ); i < count; ++i )
 		values.push_back( nullptr );
 	Value *value = values[ valueScope ];
 	if ( value )
 		return *value;
-	value = new Value;
+	value = new_value();
 	value->scope = valueScope;
 	if ( valueScope > 0 )
-		scopeWatch[ valueScope - 1 ].push_back( node->value.valueString );
+		scopeWatch[ valueScope - 1 ].push_back( &values );
 	values[ valueScope ] = value;
 	return *value;
 }
@@ -872,18 +1417,18 @@ Value &Interpreter::get_or_create_value( Node *node )
 {
 	Value *value = nullptr;
 
-	if ( node->value.valueString == "self" )
+	if ( name_of( node ) == SelfName )
 	{
 		value = context.back();
 	}
 	else
 	{
-		std::vector<Value*> &values = data[ node->value.valueString ];
+		std::vector<Value*> &values = get_slot( node );
 
 		// Check if its a local variable, will use the current scope
 		if ( node->scope == SCOPE_LOCAL )
 		{
-			value = &get_or_create_value( values, scope, node );
+			value = &get_or_create_value( values, scope );
 		}
 		else
 		{
@@ -900,7 +1445,7 @@ Value &Interpreter::get_or_create_value( Node *node )
 			}
 
 			if ( !found )
-				value = &get_or_create_value( values, 0, node );
+				value = &get_or_create_value( values, 0 );
 		}
 	}
 
@@ -909,7 +1454,7 @@ Value &Interpreter::get_or_create_value( Node *node )
 		Value *lastValue = value;
 		for ( auto &child : node->children )
 		{
-			value = &value->deref().map[ child->value.valueString ];
+			value = &value->deref().map.get_or_add( name_of( child ), child->shapeCache );
 			if ( value->type == ValueType::Undefined )
 				*value = Value( ValueType::Struct );
 			value->scope = SCOPE_STRUCT;
@@ -922,23 +1467,148 @@ Value &Interpreter::get_or_create_value( Node *node )
 
 Value &Interpreter::get_or_create_global( const char *name )
 {
-	std::vector<Value*> &values = data[ name ];
+	std::vector<Value*> &values = data[ intern( name ) ];
 
 	if ( values.empty() )
 		values.push_back( nullptr );
 	else if ( values[ SCOPE_GLOBAL ] )
 		return *values[ SCOPE_GLOBAL ];
 
-	Value *value = new Value;
+	Value *value = new_value();
 	value->scope = SCOPE_GLOBAL;
 	values[ SCOPE_GLOBAL ] = value;
 
 	return *value;
 }
 
-void Interpreter::cleanup()
+std::vector<Value*> &Interpreter::get_slot( Node *node )
+{
+	// A name's scope list keeps its address until data is cleared, which
+	// moves to a new generation and leaves every cached slot stale
+	if ( !node->slot || node->slotGeneration != dataGeneration )
+	{
+		node->slot = &data[ name_of( node ) ];
+		node->slotGeneration = dataGeneration;
+	}
+	return *node->slot;
+}
+
+void Interpreter::clear_data()
 {
 	data.clear();
+	dataGeneration += 1;
+}
+
+CallSite *Interpreter::get_call_site( Node *node, Node *funcNode )
+{
+	CallSite *callSite = node->callSite;
+
+	if ( callSite && callSite->funcNode == funcNode && callSite->generation == dataGeneration )
+		return callSite;
+
+	u64 wanted = ( funcNode->right ? funcNode->right->children.size() : 0 );
+	if ( wanted != node->children.size() )
+		fatal( RESULT_CODE_FUNCTION_ARG_COUNT, node, "Function wants {} args, but was given {} args.", wanted, node->children.size() );
+
+	if ( !callSite )
+	{
+		callSite = new CallSite;
+		callSites.push_back( callSite );
+		node->callSite = callSite;
+	}
+
+	callSite->funcNode = funcNode;
+	callSite->generation = dataGeneration;
+	callSite->argSlots.clear();
+
+	for ( u64 argIdx = 0; argIdx < wanted; ++argIdx )
+		callSite->argSlots.push_back( &get_slot( funcNode->right->children[ argIdx ] ) );
+
+	return callSite;
+}
+
+Value *Interpreter::new_value()
+{
+	if ( valuePool.empty() )
+		return new Value;
+
+	Value *value = valuePool.back();
+	valuePool.pop_back();
+	return value;
+}
+
+void Interpreter::free_value( Value *value )
+{
+	if ( valuePool.size() >= ValuePoolMax )
+	{
+		delete value;
+		return;
+	}
+
+	value->clear();
+	value->scope = SCOPE_UNSET;
+	valuePool.push_back( value );
+}
+
+// A loop only reads its source, so an array literal there is iterated where
+// it is rather than copied into a temporary
+Value Interpreter::loop_source( Node *node )
+{
+	if ( node->type != NodeID::CreateArray )
+		return run( node );
+
+	if ( node->value.type == ValueType::Arr )
+		return &node->value;
+
+	if ( arenaTop == arena.size() )
+		arena.push_back( new Value( ValueType::Arr ) );
+
+	Value *slot = arena[ arenaTop++ ];
+	slot->array_clear();
+	for ( auto child : node->children )
+		slot->array_push( run( child ) );
+	return slot;
+}
+
+// The array and index of an indexed assignment, run after its right hand side.
+// The returned value keeps a temporary array alive until store_entry.
+Value Interpreter::run_entry( Node *node, i64 *index )
+{
+	Value base = run( node->left );
+	*index = run( node->right ).get_as_i64( this, node );
+	return base;
+}
+
+ArenaMark::~ArenaMark()
+{
+	interpreter->arenaTop = top;
+}
+
+void Interpreter::cleanup()
+{
+	for ( CallSite *callSite : callSites )
+		delete callSite;
+	callSites.clear();
+	for ( VmChunk *chunk : chunks )
+		delete chunk;
+	chunks.clear();
+	for ( Value *value : valuePool )
+		delete value;
+	valuePool.clear();
+	for ( Value *value : arena )
+		delete value;
+	arena.clear();
+	arenaTop = 0;
+	jit.cleanup();
+	clear_data();
+	fileTable.cleanup();
+
+	if ( io.report && io.readFileCalls != 0 )
+	{
+		f64 rate = io.readFileMs > 0.0 ? static_cast<f64>( io.readFileBytes ) / ( io.readFileMs * 1000.0 ) : 0.0;
+		std::println( stderr, "[Interpreter] read_file {:>6} calls {:>14} bytes {:>10.3f} ms {:>10.1f} MB/s",
+			io.readFileCalls, io.readFileBytes, io.readFileMs, rate );
+	}
 }
 
 void Interpreter::scope_push( Value *newContext )
@@ -952,11 +1622,11 @@ void Interpreter::scope_pop()
 {
 	context.pop_back();
 
-	for ( auto &entry : scopeWatch.back() )
+	// a deeper scope may have padded the list past this one, those entries are empty now
+	for ( std::vector<Value*> *values : scopeWatch.back() )
 	{
-		std::vector<Value*> &values = data[ entry ];
-		delete values.back();
-		values.pop_back();
+		free_value( ( *values )[ scope ] );
+		values->resize( scope );
 	}
 
 	scopeWatch.pop_back();
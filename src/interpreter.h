@@ -6,30 +6,141 @@
 #include <functional>
 
 #include "parser.h"
+#include "jit.h"
+#include "vm.h"
+#include "os.h"
+
+// Inline cache for a FunctionCall node. Remembers the function that was last called
+// from the site and the variable slots its parameters bind to, so repeated calls
+// only need a pointer compare to reuse the argument layout.
+struct CallSite
+{
+	Node *funcNode;
+	std::vector<std::vector<Value*>*> argSlots;
+	u32 generation;
+};
+
+// Script function activation. Script calls push frames here rather than
+// nesting on the native stack, a tail call hands its frame to the callee and
+// runaway recursion fails cleanly.
+struct Frame
+{
+	Node *callNode;
+	Node *funcNode;
+	CallSite *callSite;
+	JitRegion *region;
+	// scope the call was made from, the frame's own scopes sit above it
+	i32 baseScope;
+	// first of vmLoops belonging to the frame
+	u64 loopBase;
+	// where the caller carries on, none when native code called in through invoke
+	const VmInstr *returnCode;
+	u32 returnPc;
+	// callee of a tail call, between TailBegin and TailCall
+	Node *tailFunc;
+	Value *tailContext;
+};
+
+constexpr u64 MaxCallDepth = 100000;
+// Native stack kept free below the deepest native entry, for the builtins
+// and expressions a call runs before the next depth check
+constexpr u64 NativeStackMargin = 1024 * 1024;
+constexpr u64 ValuePoolMax = 1024;
+
+struct Interpreter;
+
+// Gives back the arena slots taken while it was alive
+struct ArenaMark
+{
+	Interpreter *interpreter;
+	u32 top;
+
+	~ArenaMark();
+};
+
+// Names the interpreter looks up for itself
+inline const InternedString *const SelfName = intern( "self" );
+inline const InternedString *const LoopIndexName = intern( "lidx" );
+
+// Totals printed by --io-report
+struct IoStats
+{
+	bool report = false;
+	u64 readFileCalls = 0;
+	u64 readFileBytes = 0;
+	f64 readFileMs = 0.0;
+};
 
 struct Interpreter
 {
-	using ValueMap = std::unordered_map<std::string, std::vector<Value*>>;
+	using ValueMap = std::unordered_map<const InternedString*, std::vector<Value*>, InternedHash>;
 
 	ValueMap data;
-	std::vector<std::vector<std::string>> scopeWatch;
+	// bumped whenever data is cleared, so slots cached before are found again
+	u32 dataGeneration = 1;
+	std::vector<std::vector<std::vector<Value*>*>> scopeWatch;
 	i32 scope;
 	Value *chainedDotAccess;
+	// scope of the variable the last chained access started from
+	i32 chainedScope = SCOPE_GLOBAL;
 	std::vector<Value *> context;
 	std::vector<std::string> filenames;
 	std::unordered_map<std::string, std::function<void()>> builtInImports;
 	std::vector<std::string> programArgs;
+	std::vector<CallSite*> callSites;
+	std::vector<Frame> callStack;
+	Node *tailCall = nullptr;
+	Node *tailFunc = nullptr;
+	Value *tailContext = nullptr;
+	bool returning = false;
+	// operands and loop states of the frame loop, shared by every frame
+	std::vector<Value> vmStack;
+	std::vector<VmLoop> vmLoops;
+	std::vector<VmChunk*> chunks;
+	char *stackBase = nullptr;
+	// native stack calls may use below stackBase, read from the thread at startup
+	u64 stackBudget = 0;
+	std::vector<Value*> valuePool;
+	// array literals looped over, kept so rebuilding one reuses its storage
+	std::vector<Value*> arena;
+	u32 arenaTop = 0;
+	Jit jit;
+	std::vector<i64> jitSlots;
+	IoStats io;
+	FileTable fileTable;
 
 	void set_args( i32 argc, char *argv[] );
 	Value run( std::vector<std::string> files, Node *node );
 	Value run( Node *node );
+	Value call( Node *node, bool tail = false );
+	Value invoke( Node *node, Node *funcNode, CallSite *callSite, Value *callContext, const Value *args );
+	Value run_frames();
+	bool frame_enter( const VmInstr **code, u32 *pc, Value *value );
+	bool frame_leave( const VmInstr **code, u32 *pc, Value &value );
+	void frame_unwind( Value &value );
+	void frame_tail( Node *node, Node *funcNode, Value *callContext );
+	bool tail_safe( Value *callContext ) const;
+	Value operation( Node *node, const Value &lhs, const Value &rhs );
+	Value assign( Node *node, Value value );
+	Value assign_op( Node *node, Value value, const Value &rhs );
+	Value assign_op_entry( Node *node, const Value &rhs );
+	bool compare( Node *node );
 	Value *chain_access( Node *node, Value *value );
 	Value *get_value_if_exists( Node *node );
 	Value &get_value( Node *node );
-	Value &get_or_create_value( const char *name );
-	Value &get_or_create_value( std::vector<Value*> &values, i32 valueScope, Node *node );
+	Value &get_or_create_value( const InternedString *name );
+	Value &get_or_create_value( std::vector<Value*> &values, i32 valueScope );
 	Value &get_or_create_value( Node *node );
 	Value &get_or_create_global( const char *name );
+	std::vector<Value*> &get_slot( Node *node );
+	void clear_data();
+	CallSite *get_call_site( Node *node, Node *funcNode );
+	Value *new_value();
+	void free_value( Value *value );
+	Value loop_source( Node *node );
+	Value run_entry( Node *node, i64 *index );
+	bool jit_enter( Node *node, JitRegion *region, i64 *loop, Value *ret );
+	void jit_verify( Node *node, JitRegion *region, bool returned, const Value &ret );
 
 	void cleanup();
 
@@ -0,0 +1,622 @@
+
+#include <cstring>
+
+#include "jit.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+	#define JIT_X64 1
+#else
+	#define JIT_X64 0
+#endif
+
+// Registers, the slot array lives in r11 and the result pointer in r10
+enum X64
+{
+	X64_RAX = 0,
+	X64_RCX = 1,
+};
+
+struct JitLoop
+{
+	std::vector<u64> breaks;
+	std::vector<u64> continues;
+};
+
+struct JitCompiler
+{
+	std::vector<u8> code;
+	std::unordered_map<std::string, i32> slots;
+	std::vector<Node*> names;
+	// NumberI64 or NumberI32 for each named slot, i32 slots hold sign extended values
+	std::vector<ValueType> types;
+	JitTypeOf typeOf;
+	u32 temporaries;
+	std::vector<JitLoop> loops;
+	bool allowReturn;
+};
+
+static void emit( JitCompiler *jc, std::initializer_list<u8> bytes )
+{
+	jc->code.insert( jc->code.end(), bytes );
+}
+
+static void emit32( JitCompiler *jc, u32 value )
+{
+	for ( i32 i = 0; i < 4; ++i )
+		jc->code.push_back( static_cast<u8>( value >> ( i * 8 ) ) );
+}
+
+static void emit64( JitCompiler *jc, u64 value )
+{
+	for ( i32 i = 0; i < 8; ++i )
+		jc->code.push_back( static_cast<u8>( value >> ( i * 8 ) ) );
+}
+
+// Named slots sit at positive offsets from r11, temporaries below it
+static u32 slot_offset( i32 slot )
+{
+	return static_cast<u32>( slot * static_cast<i32>( sizeof( i64 ) ) );
+}
+
+// mov reg, [r11 + slot]
+static void emit_load( JitCompiler *jc, X64 reg, i32 slot )
+{
+	emit( jc, { 0x49, 0x8B, static_cast<u8>( 0x83 | ( reg << 3 ) ) } );
+	emit32( jc, slot_offset( slot ) );
+}
+
+// mov [r11 + slot], rax
+static void emit_store( JitCompiler *jc, i32 slot )
+{
+	emit( jc, { 0x49, 0x89, 0x83 } );
+	emit32( jc, slot_offset( slot ) );
+}
+
+// jmp/jcc rel32, returns the offset of the displacement to patch
+static u64 emit_jump( JitCompiler *jc, u8 condition )
+{
+	if ( condition )
+		emit( jc, { 0x0F, condition } );
+	else
+		emit( jc, { 0xE9 } );
+	u64 at = jc->code.size();
+	emit32( jc, 0 );
+	return at;
+}
+
+static void patch( JitCompiler *jc, u64 at, u64 target )
+{
+	u32 rel = static_cast<u32>( static_cast<i64>( target ) - static_cast<i64>( at + 4 ) );
+	std::memcpy( &jc->code[ at ], &rel, sizeof( rel ) );
+}
+
+static void emit_return( JitCompiler *jc, JIT_STATUS status )
+{
+	// mov eax, status ; ret
+	emit( jc, { 0xB8 } );
+	emit32( jc, status );
+	emit( jc, { 0xC3 } );
+}
+
+static bool is_plain_name( Node *node )
+{
+	if ( node->type != NodeID::Identifier && node->type != NodeID::CreateIdentifier )
+		return false;
+	if ( node->left || !node->children.empty() || node->scope == SCOPE_LOCAL )
+		return false;
+	const std::string &name = node->value.valueString;
+	return name != "self" && name != "lidx";
+}
+
+static i32 slot_of( JitCompiler *jc, Node *node )
+{
+	auto it = jc->slots.find( node->value.valueString );
+	if ( it != jc->slots.end() )
+		return it->second;
+
+	i32 slot = static_cast<i32>( jc->names.size() );
+	jc->slots[ node->value.valueString ] = slot;
+	jc->names.push_back( node );
+	// a variable missing or of another type now fails the entry guards
+	jc->types.push_back( jc->typeOf( node ) == ValueType::NumberI32 ? ValueType::NumberI32 : ValueType::NumberI64 );
+	return slot;
+}
+
+// Reserves consecutive temporaries, returns the lowest
+static i32 new_temporaries( JitCompiler *jc, u32 count )
+{
+	jc->temporaries += count;
+	return -static_cast<i32>( jc->temporaries );
+}
+
+// Wraps rax to 32 bits as the interpreter's i32 arithmetic does
+static void emit_wrap_i32( JitCompiler *jc )
+{
+	emit( jc, { 0x48, 0x63, 0xC0 } );				// movsxd rax, eax
+}
+
+// Leaves the value of an integer expression in rax and its type in type, an
+// i32 is sign extended so it widens for free when paired with an i64
+static bool compile_expr( JitCompiler *jc, Node *node, ValueType *type )
+{
+	switch ( node->type )
+	{
+	case NodeID::Number:
+		if ( node->value.type != ValueType::NumberI64 && node->value.type != ValueType::NumberI32 )
+			return false;
+		*type = node->value.type;
+		// mov rax, imm64
+		emit( jc, { 0x48, 0xB8 } );
+		emit64( jc, static_cast<u64>( node->value.type == ValueType::NumberI64 ? node->value.valueI64 : node->value.valueI32 ) );
+		return true;
+
+	case NodeID::Identifier:
+		if ( !is_plain_name( node ) )
+			return false;
+		{
+			i32 slot = slot_of( jc, node );
+			*type = jc->types[ slot ];
+			emit_load( jc, X64_RAX, slot );
+		}
+		return true;
+
+	case NodeID::Operation:
+		{
+			u8 op;
+
+			switch ( node->token->id )
+			{
+			case TokenID::Plus:		op = 0x01; break;
+			case TokenID::Minus:	op = 0x29; break;
+			case TokenID::Amp:		op = 0x21; break;
+			case TokenID::Pipe:		op = 0x09; break;
+			case TokenID::Hat:		op = 0x31; break;
+			case TokenID::Asterisk:	op = 0; break;
+			default:
+				// comparisons give i32 values and division can fault
+				return false;
+			}
+
+			ValueType leftType, rightType;
+			if ( !compile_expr( jc, node->right, &rightType ) )
+				return false;
+			emit( jc, { 0x50 } );				// push rax
+			if ( !compile_expr( jc, node->left, &leftType ) )
+				return false;
+			emit( jc, { 0x59 } );				// pop rcx
+
+			if ( op )
+				emit( jc, { 0x48, op, 0xC8 } );		// op rax, rcx
+			else
+				emit( jc, { 0x48, 0x0F, 0xAF, 0xC1 } );	// imul rax, rcx
+
+			// i32 with i32 stays an i32, anything with an i64 is an i64
+			*type = ( leftType == ValueType::NumberI32 && rightType == ValueType::NumberI32 ? ValueType::NumberI32 : ValueType::NumberI64 );
+			if ( *type == ValueType::NumberI32 )
+				emit_wrap_i32( jc );
+		}
+		return true;
+	}
+
+	return false;
+}
+
+// Jumps to the returned patch offset when the condition is false
+static bool compile_condition( JitCompiler *jc, Node *node, u64 *falseJump )
+{
+	if ( node->type == NodeID::Operation )
+	{
+		u8 inverse = 0;
+
+		switch ( node->token->id )
+		{
+		case TokenID::DoubleAssign:			inverse = 0x85; break;	// jne
+		case TokenID::ExclamationAssign:	inverse = 0x84; break;	// je
+		case TokenID::LesserThan:			inverse = 0x8D; break;	// jge
+		case TokenID::LesserOrEqual:		inverse = 0x8F; break;	// jg
+		case TokenID::GreaterThan:			inverse = 0x8E; break;	// jle
+		case TokenID::GreaterOrEqual:		inverse = 0x8C; break;	// jl
+		}
+
+		if ( inverse )
+		{
+			ValueType type;
+			if ( !compile_expr( jc, node->right, &type ) )
+				return false;
+			emit( jc, { 0x50 } );				// push rax
+			if ( !compile_expr( jc, node->left, &type ) )
+				return false;
+			emit( jc, { 0x59 } );				// pop rcx
+			emit( jc, { 0x48, 0x39, 0xC8 } );	// cmp rax, rcx
+			*falseJump = emit_jump( jc, inverse );
+			return true;
+		}
+	}
+
+	ValueType type;
+	if ( !compile_expr( jc, node, &type ) )
+		return false;
+	emit( jc, { 0x48, 0x85, 0xC0 } );			// test rax, rax
+	*falseJump = emit_jump( jc, 0x84 );			// je
+	return true;
+}
+
+static bool compile_statements( JitCompiler *jc, std::vector<Node*> &statements );
+
+static bool compile_for_range( JitCompiler *jc, Node *node, i32 indexSlot );
+
+static bool compile_statement( JitCompiler *jc, Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Assignment:
+		{
+			// the variable keeps the type its slot was compiled for
+			ValueType type;
+			if ( !is_plain_name( node->left ) || !compile_expr( jc, node->right, &type ) )
+				return false;
+			i32 slot = slot_of( jc, node->left );
+			if ( jc->types[ slot ] != type )
+				return false;
+			emit_store( jc, slot );
+		}
+		return true;
+
+	case NodeID::AssignmentOp:
+	case NodeID::AssignmentOpConst:
+		{
+			u8 op;
+
+			switch ( node->token->id )
+			{
+			case TokenID::PlusAssign:		op = 0x01; break;
+			case TokenID::MinusAssign:		op = 0x29; break;
+			case TokenID::AmpAssign:		op = 0x21; break;
+			case TokenID::PipeAssign:		op = 0x09; break;
+			case TokenID::HatAssign:		op = 0x31; break;
+			case TokenID::AsteriskAssign:	op = 0; break;
+			default:
+				return false;
+			}
+
+			ValueType type;
+			if ( !is_plain_name( node->left ) || !compile_expr( jc, node->right, &type ) )
+				return false;
+
+			// an i32 variable given an i64 would become an i64
+			i32 slot = slot_of( jc, node->left );
+			if ( jc->types[ slot ] == ValueType::NumberI32 && type != ValueType::NumberI32 )
+				return false;
+
+			emit( jc, { 0x48, 0x89, 0xC1 } );			// mov rcx, rax
+			emit_load( jc, X64_RAX, slot );
+			if ( op )
+				emit( jc, { 0x48, op, 0xC8 } );			// op rax, rcx
+			else
+				emit( jc, { 0x48, 0x0F, 0xAF, 0xC1 } );	// imul rax, rcx
+			if ( jc->types[ slot ] == ValueType::NumberI32 )
+				emit_wrap_i32( jc );
+			emit_store( jc, slot );
+		}
+		return true;
+
+	case NodeID::Block:
+		return compile_statements( jc, node->children );
+
+	case NodeID::If:
+	case NodeID::IfCompare:
+		{
+			u64 falseJump;
+			if ( !compile_condition( jc, node->left, &falseJump ) || !compile_statements( jc, node->children ) )
+				return false;
+
+			if ( !node->right )
+			{
+				patch( jc, falseJump, jc->code.size() );
+				return true;
+			}
+
+			u64 endJump = emit_jump( jc, 0 );
+			patch( jc, falseJump, jc->code.size() );
+			if ( !compile_statement( jc, node->right ) )
+				return false;
+			patch( jc, endJump, jc->code.size() );
+		}
+		return true;
+
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		{
+			// the condition is checked once before the body, and after it
+			u64 skipJump;
+			if ( !compile_condition( jc, node->left, &skipJump ) )
+				return false;
+
+			u64 top = jc->code.size();
+			jc->loops.emplace_back();
+			if ( !compile_statements( jc, node->children ) )
+				return false;
+
+			u64 check = jc->code.size();
+			u64 exitJump;
+			if ( !compile_condition( jc, node->left, &exitJump ) )
+				return false;
+			patch( jc, emit_jump( jc, 0 ), top );
+
+			u64 exit = jc->code.size();
+			patch( jc, skipJump, exit );
+			patch( jc, exitJump, exit );
+
+			for ( u64 at : jc->loops.back().breaks )
+				patch( jc, at, exit );
+			for ( u64 at : jc->loops.back().continues )
+				patch( jc, at, check );
+			jc->loops.pop_back();
+		}
+		return true;
+
+	case NodeID::ForNumberRange:
+		{
+			if ( !is_plain_name( node->left ) )
+				return false;
+
+			i32 indexSlot = new_temporaries( jc, 3 );
+
+			// index = start, end = end, dir = sign( end - start )
+			ValueType type;
+			if ( !compile_expr( jc, node->right, &type ) )
+				return false;
+			emit_store( jc, indexSlot );
+			if ( !compile_expr( jc, node->right->right, &type ) )
+				return false;
+			emit_store( jc, indexSlot + 1 );
+			emit( jc, { 0x49, 0x2B, 0x83 } );			// sub rax, [r11 + index]
+			emit32( jc, slot_offset( indexSlot ) );
+			emit( jc, { 0x48, 0x89, 0xC1 } );			// mov rcx, rax
+			emit( jc, { 0x48, 0xC1, 0xF9, 0x3F } );		// sar rcx, 63
+			emit( jc, { 0x48, 0xF7, 0xD8 } );			// neg rax
+			emit( jc, { 0x48, 0xC1, 0xE8, 0x3F } );		// shr rax, 63
+			emit( jc, { 0x48, 0x09, 0xC1 } );			// or rcx, rax
+			emit( jc, { 0x49, 0x89, 0x8B } );			// mov [r11 + dir], rcx
+			emit32( jc, slot_offset( indexSlot + 2 ) );
+
+			return compile_for_range( jc, node, indexSlot );
+		}
+
+	case NodeID::Break:
+	case NodeID::Continue:
+		if ( jc->loops.empty() )
+			return false;
+		if ( node->type == NodeID::Break )
+			jc->loops.back().breaks.push_back( emit_jump( jc, 0 ) );
+		else
+			jc->loops.back().continues.push_back( emit_jump( jc, 0 ) );
+		return true;
+
+	case NodeID::Return:
+		if ( !jc->allowReturn )
+			return false;
+
+		if ( !node->left )
+		{
+			if ( node->value.type != ValueType::NumberI32 )
+				return false;
+			emit( jc, { 0x48, 0xB8 } );				// mov rax, imm64
+			emit64( jc, static_cast<u64>( static_cast<i64>( node->value.valueI32 ) ) );
+			emit( jc, { 0x49, 0x89, 0x02 } );		// mov [r10], rax
+			emit_return( jc, JIT_STATUS_RETURN_I32 );
+			return true;
+		}
+
+		{
+			ValueType type;
+			if ( !compile_expr( jc, node->left, &type ) )
+				return false;
+			emit( jc, { 0x49, 0x89, 0x02 } );		// mov [r10], rax
+			emit_return( jc, type == ValueType::NumberI32 ? JIT_STATUS_RETURN_I32 : JIT_STATUS_RETURN_I64 );
+		}
+		return true;
+	}
+
+	return false;
+}
+
+// The loop part of a ForNumberRange, entered with index, end and dir in their
+// slots. A region compiled for a hot loop starts here in the middle of the loop.
+static bool compile_for_range( JitCompiler *jc, Node *node, i32 indexSlot )
+{
+	// the loop variable is always an i64
+	i32 slot = slot_of( jc, node->left );
+	if ( jc->types[ slot ] != ValueType::NumberI64 )
+		return false;
+
+	u64 top = jc->code.size();
+	emit_load( jc, X64_RAX, indexSlot );
+	emit_store( jc, slot );
+
+	jc->loops.emplace_back();
+	if ( !compile_statements( jc, node->children ) )
+		return false;
+
+	// if ( index == end ) break; index += dir
+	u64 check = jc->code.size();
+	emit_load( jc, X64_RAX, indexSlot );
+	emit( jc, { 0x49, 0x3B, 0x83 } );				// cmp rax, [r11 + end]
+	emit32( jc, slot_offset( indexSlot + 1 ) );
+	u64 exitJump = emit_jump( jc, 0x84 );			// je
+	emit( jc, { 0x49, 0x03, 0x83 } );				// add rax, [r11 + dir]
+	emit32( jc, slot_offset( indexSlot + 2 ) );
+	emit_store( jc, indexSlot );
+	patch( jc, emit_jump( jc, 0 ), top );
+
+	u64 exit = jc->code.size();
+	patch( jc, exitJump, exit );
+
+	for ( u64 at : jc->loops.back().breaks )
+		patch( jc, at, exit );
+	for ( u64 at : jc->loops.back().continues )
+		patch( jc, at, check );
+	jc->loops.pop_back();
+
+	return true;
+}
+
+static bool compile_statements( JitCompiler *jc, std::vector<Node*> &statements )
+{
+	for ( auto statement : statements )
+	{
+		if ( !compile_statement( jc, statement ) )
+			return false;
+	}
+	return true;
+}
+
+JitRegion *Jit::region( Node *node )
+{
+	if ( !node->jitRegion )
+	{
+		JitRegion *region = new JitRegion;
+		region->state = JitState::Counting;
+		region->hotness = 0;
+		region->guardFailures = 0;
+		region->entry = nullptr;
+		region->code = nullptr;
+		region->codeSize = 0;
+		region->temporaries = 0;
+		region->loopSlot = 0;
+		region->verifying = false;
+		region->verifyDepth = 0;
+		region->expectedStatus = JIT_STATUS_DONE;
+		region->expectedResult = 0;
+		regions.push_back( region );
+		node->jitRegion = region;
+	}
+
+	return node->jitRegion;
+}
+
+bool Jit::compile( JitRegion *region, Node *node, const JitTypeOf &typeOf )
+{
+	region->state = JitState::Failed;
+
+#if JIT_X64
+	JitCompiler jc;
+	jc.typeOf = typeOf;
+	jc.temporaries = 0;
+	jc.allowReturn = true;
+
+	// -- prologue, move the arguments into r11 and r10 --
+#ifdef _WIN32
+	emit( &jc, { 0x49, 0x89, 0xCB } );				// mov r11, rcx
+	emit( &jc, { 0x49, 0x89, 0xD2 } );				// mov r10, rdx
+#else
+	emit( &jc, { 0x49, 0x89, 0xFB } );				// mov r11, rdi
+	emit( &jc, { 0x49, 0x89, 0xF2 } );				// mov r10, rsi
+#endif
+
+	bool compiled = false;
+
+	switch ( node->type )
+	{
+	case NodeID::DeclFunc:
+		// parameters are bound by the interpreter before entering
+		for ( auto param : ( node->right ? node->right->children : std::vector<Node*>() ) )
+		{
+			if ( !is_plain_name( param ) )
+				return false;
+			slot_of( &jc, param );
+		}
+		compiled = compile_statements( &jc, node->children );
+		break;
+
+	case NodeID::ForNumberRange:
+		if ( !is_plain_name( node->left ) )
+			return false;
+		region->loopSlot = new_temporaries( &jc, 3 );
+		compiled = compile_for_range( &jc, node, region->loopSlot );
+		break;
+
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		{
+			// entered at the condition check after an interpreted iteration
+			u64 top = jc.code.size();
+			u64 exitJump;
+			jc.loops.emplace_back();
+			compiled = compile_condition( &jc, node->left, &exitJump ) && compile_statements( &jc, node->children );
+			if ( compiled )
+			{
+				patch( &jc, emit_jump( &jc, 0 ), top );
+				u64 exit = jc.code.size();
+				patch( &jc, exitJump, exit );
+				for ( u64 at : jc.loops.back().breaks )
+					patch( &jc, at, exit );
+				for ( u64 at : jc.loops.back().continues )
+					patch( &jc, at, top );
+			}
+		}
+		break;
+	}
+
+	if ( !compiled )
+		return false;
+
+	emit_return( &jc, JIT_STATUS_DONE );
+
+	region->names = jc.names;
+	region->types = jc.types;
+	region->temporaries = jc.temporaries;
+
+#ifdef _WIN32
+	void *code = VirtualAlloc( nullptr, jc.code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+	if ( !code )
+		return false;
+	std::memcpy( code, jc.code.data(), jc.code.size() );
+	DWORD oldProtect;
+	if ( !VirtualProtect( code, jc.code.size(), PAGE_EXECUTE_READ, &oldProtect ) )
+		return false;
+	FlushInstructionCache( GetCurrentProcess(), code, jc.code.size() );
+#else
+	void *code = mmap( nullptr, jc.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( code == MAP_FAILED )
+		return false;
+	std::memcpy( code, jc.code.data(), jc.code.size() );
+	if ( mprotect( code, jc.code.size(), PROT_READ | PROT_EXEC ) != 0 )
+		return false;
+#endif
+
+	region->code = code;
+	region->codeSize = jc.code.size();
+	region->entry = reinterpret_cast<JitEntry>( code );
+	region->state = JitState::Compiled;
+
+	return true;
+#else
+	(void)node;
+	(void)typeOf;
+	return false;
+#endif
+}
+
+void Jit::cleanup()
+{
+	for ( JitRegion *region : regions )
+	{
+		if ( region->code )
+		{
+#ifdef _WIN32
+			VirtualFree( region->code, 0, MEM_RELEASE );
+#else
+			munmap( region->code, region->codeSize );
+#endif
+		}
+		delete region;
+	}
+	regions.clear();
+}
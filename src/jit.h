@@ -0,0 +1,75 @@
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "parser.h"
+
+// Loop iterations or function calls before a region gets compiled
+constexpr u32 JitThresholdDefault = 1000;
+// Entries whose guards fail before a region is left to the interpreter for good
+constexpr u32 JitMaxGuardFailures = 8;
+
+enum JIT_STATUS
+{
+	JIT_STATUS_DONE,
+	JIT_STATUS_RETURN_I64,
+	JIT_STATUS_RETURN_I32,
+};
+
+enum class JitState
+{
+	Counting,
+	Compiled,
+	Failed,
+};
+
+// Native code works on a copy of the variables, one i64 per slot. Named slots
+// are loaded from and stored back to script variables, temporaries sit below
+// the slot pointer.
+using JitEntry = i32 (*)( i64 *slots, i64 *result );
+
+// Type a name holds when its region compiles, Undefined when it doesn't exist
+using JitTypeOf = std::function<ValueType( Node* )>;
+
+struct JitRegion
+{
+	JitState state;
+	u32 hotness;
+	u32 guardFailures;
+	JitEntry entry;
+	void *code;
+	u64 codeSize;
+	std::vector<Node*> names;
+	// NumberI64 or NumberI32, what each name has to hold on entry
+	std::vector<ValueType> types;
+	u32 temporaries;
+	// index, end and direction temporaries of a ForNumberRange region
+	i32 loopSlot;
+
+	// variables the names resolved to on the last entry
+	std::vector<Value*> values;
+
+	// -- differential mode --
+	bool verifying;
+	// call depth of the entry being verified, recursion doesn't check it early
+	u64 verifyDepth;
+	std::vector<i64> expected;
+	i32 expectedStatus;
+	i64 expectedResult;
+};
+
+struct Jit
+{
+	bool enabled = false;
+	bool differential = false;
+	u32 threshold = JitThresholdDefault;
+	std::vector<JitRegion*> regions;
+
+	JitRegion *region( Node *node );
+	bool compile( JitRegion *region, Node *node, const JitTypeOf &typeOf );
+	void cleanup();
+};
@@ -11,17 +11,85 @@
 #include "lexer.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "optimiser.h"
+#include "emit_cpp.h"
 #include "result_code.h"
 
+// Programs translated by --emit-cpp bring their own main
+#ifndef AZCODE_AOT
 i32 main( i32 argc, char *argv[] )
 {
-	if ( argc < 2 )
+	Optimiser optimiser;
+	Jit jit;
+	std::string emitCpp;
+	bool ioReport = false;
+
+	// -- options come before the file to run --
+	i32 argIdx = 1;
+	for ( ; argIdx < argc && argv[ argIdx ][ 0 ] == '-'; ++argIdx )
+	{
+		std::string_view option = argv[ argIdx ];
+
+		if ( option == "-O0" || option == "-O1" || option == "-O2" )
+		{
+			optimiser.level = option[ 2 ] - '0';
+		}
+		else if ( option == "--opt-report" )
+		{
+			optimiser.report = true;
+		}
+		else if ( option == "--io-report" )
+		{
+			ioReport = true;
+		}
+		else if ( option == "--no-inline" )
+		{
+			optimiser.inlineMaxNodes = 0;
+		}
+		else if ( option.starts_with( "--inline-size=" ) )
+		{
+			if ( to_int( &optimiser.inlineMaxNodes, option.data() + 14 ) != ToIntResult::Success )
+			{
+				std::println( stderr, "Invalid inline size: {}", option );
+				return RESULT_CODE_INVALID_OPTION;
+			}
+		}
+		else if ( option.starts_with( "--emit-cpp=" ) )
+		{
+			emitCpp = option.substr( 11 );
+		}
+		else if ( option == "--jit" )
+		{
+			jit.enabled = true;
+		}
+		else if ( option == "--jit-diff" )
+		{
+			// runs every native region under the interpreter as well and compares
+			jit.enabled = true;
+			jit.differential = true;
+		}
+		else if ( option.starts_with( "--jit-threshold=" ) )
+		{
+			if ( to_int( &jit.threshold, option.data() + 16 ) != ToIntResult::Success )
+			{
+				std::println( stderr, "Invalid jit threshold: {}", option );
+				return RESULT_CODE_INVALID_OPTION;
+			}
+		}
+		else
+		{
+			std::println( stderr, "Unknown option: {}", option );
+			return RESULT_CODE_INVALID_OPTION;
+		}
+	}
+
+	if ( argIdx >= argc )
 	{
 		std::println( stderr, "Missing file to run." );
 		return RESULT_CODE_NO_FILE_INPUT_TO_PROCESS;
 	}
 
-	std::string filename = argv[ 1 ];
+	std::string filename = argv[ argIdx ];
 	std::string data;
 
 	{
@@ -40,10 +108,28 @@ i32 main( i32 argc, char *argv[] )
 	Parser parser;
 	Interpreter interpreter;
 
-	interpreter.set_args( argc - 1, &argv[ 1 ] );
+	interpreter.jit = jit;
+	interpreter.io.report = ioReport;
+	interpreter.set_args( argc - argIdx, &argv[ argIdx ] );
 
 	lexer.run( filename, std::move( data ) );
 	parser.run( std::move( lexer.tokens ) );
+	optimiser.run( parser.root );
+
+	if ( !emitCpp.empty() )
+	{
+		CppEmitter emitter;
+		bool emitted = emitter.run( parser.root, lexer.filenames, filename, emitCpp );
+		lexer.cleanup();
+		parser.cleanup();
+		if ( !emitted )
+		{
+			std::println( stderr, "Unable to write file: {}", emitCpp );
+			return RESULT_CODE_FAILED_TO_OPEN_OUTPUT_FILE;
+		}
+		return RESULT_CODE_SUCCESS;
+	}
+
 	i32 ret = interpreter.run( std::move( lexer.filenames ), parser.root ).valueI32;
 
 	lexer.cleanup();
@@ -55,13 +141,20 @@ i32 main( i32 argc, char *argv[] )
 
 	return ret;
 }
+#endif
 
 // -- Unity Build --
 #include "value.cpp"
+#include "collections.cpp"
+#include "text.cpp"
 #include "token.cpp"
 #include "enums.cpp"
 #include "lexer.cpp"
 #include "parser.cpp"
+#include "optimiser.cpp"
 #include "interpreter.cpp"
+#include "vm.cpp"
 #include "os.cpp"
-#include "net.cpp"
\ No newline at end of file
+#include "net.cpp"
+#include "jit.cpp"
+#include "emit_cpp.cpp"
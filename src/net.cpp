@@ -315,9 +315,18 @@ Value BuiltInNode_Struct_NET_Send( Interpreter *interpreter, Value &self, Node *
 	interpreter->expect_arg( "socksend", args, 3 );
 	Arg arg = &args->children[ 0 ];
 	SOCKET socket = (SOCKET)interpreter->run( arg ).get_as_i32( interpreter, arg.next() );
-	std::string data = interpreter->run( arg ).get_as_string( interpreter, arg.next() );
+
+	// strings and byte views are sent from where they are
+	Value dataValue = interpreter->run( arg );
+	Value &source = dataValue.deref();
+	std::string text;
+	std::string_view data = ( is_text( source.type ) ? text_view( source ) : ( text = source.get_as_string( interpreter, arg ) ) );
+	arg.next();
+
 	i32 bytes = interpreter->run( arg ).get_as_i32( interpreter, arg );
-	return netsend( socket, data.c_str(), bytes );
+	if ( bytes > 0 && static_cast<u64>( bytes ) > data.size() )
+		bytes = static_cast<i32>( data.size() );
+	return netsend( socket, data.data(), bytes );
 }
 
 Value BuiltInNode_Struct_NET_Recv( Interpreter *interpreter, Value &self, Node *args )
@@ -0,0 +1,979 @@
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <print>
+
+#include "optimiser.h"
+
+static const std::string &last_name( Node *idNode )
+{
+	if ( idNode->children.empty() )
+		return idNode->value.valueString;
+	return idNode->children.back()->value.valueString;
+}
+
+static const std::vector<Node*> &params_of( Node *declFunc )
+{
+	static const std::vector<Node*> none;
+	return declFunc->right ? declFunc->right->children : none;
+}
+
+static void free_node( Node *node )
+{
+	std::vector<Node*> nodes = { node };
+	while ( !nodes.empty() )
+	{
+		node = nodes.back();
+		nodes.pop_back();
+		if ( !node )
+			continue;
+		nodes.push_back( node->left );
+		nodes.push_back( node->right );
+		for ( auto child : node->children )
+			nodes.push_back( child );
+		delete node;
+	}
+}
+
+static Node *clone_node( Node *node )
+{
+	if ( !node )
+		return nullptr;
+
+	Node *clone = new Node;
+	clone->type = node->type;
+	clone->token = node->token;
+	clone->value = node->value;
+	clone->left = clone_node( node->left );
+	clone->right = clone_node( node->right );
+	clone->scope = node->scope;
+
+	for ( auto child : node->children )
+		clone->children.push_back( clone_node( child ) );
+
+	return clone;
+}
+
+static void add_use( Optimiser *optimiser, const std::string &name )
+{
+	optimiser->candidates[ name ].uses += 1;
+}
+
+// Counts every declaration and every use of a name. A function is only inlined
+// when its name is declared once and never used outside of a call.
+static void optimiser_collect( Optimiser *optimiser, Node *node, bool callee = false )
+{
+	if ( !node )
+		return;
+
+	switch ( node->type )
+	{
+	case NodeID::DeclFunc:
+		{
+			InlineCandidate &candidate = optimiser->candidates[ last_name( node->left ) ];
+			candidate.declFunc = node;
+			candidate.decls += 1;
+
+			optimiser_collect( optimiser, node->right );
+			for ( auto child : node->children )
+				optimiser_collect( optimiser, child );
+		}
+		return;
+
+	case NodeID::FunctionCall:
+		optimiser_collect( optimiser, node->left, true );
+		for ( auto child : node->children )
+			optimiser_collect( optimiser, child );
+		return;
+
+	case NodeID::Identifier:
+	case NodeID::CreateIdentifier:
+		{
+			u64 count = node->children.size();
+
+			if ( !callee || count > 0 )
+				add_use( optimiser, node->value.valueString );
+
+			for ( u64 i = 0; i < count; ++i )
+			{
+				if ( !callee || i + 1 < count )
+					add_use( optimiser, node->children[ i ]->value.valueString );
+			}
+
+			optimiser_collect( optimiser, node->left );
+		}
+		return;
+	}
+
+	optimiser_collect( optimiser, node->left );
+	optimiser_collect( optimiser, node->right );
+	for ( auto child : node->children )
+		optimiser_collect( optimiser, child );
+}
+
+// Variables the expression reads, the fields chained after one are left out
+static void read_names( Node *node, std::vector<std::string> *names )
+{
+	if ( !node )
+		return;
+
+	if ( node->type == NodeID::Identifier )
+	{
+		names->push_back( node->value.valueString );
+		read_names( node->left, names );
+		return;
+	}
+
+	read_names( node->left, names );
+	read_names( node->right, names );
+	for ( auto child : node->children )
+		read_names( child, names );
+}
+
+// Only expressions without side effects can be moved into the caller, where
+// arguments may be evaluated more than once or not at all. Having no calls
+// also keeps the function from being recursive.
+static bool is_pure( Node *node, u32 *count )
+{
+	if ( !node )
+		return true;
+
+	*count += 1;
+
+	switch ( node->type )
+	{
+	case NodeID::Identifier:
+	case NodeID::Number:
+	case NodeID::StringLiteral:
+	case NodeID::Operation:
+	case NodeID::ArrayAccess:
+	case NodeID::CreateArray:
+		break;
+
+	default:
+		return false;
+	}
+
+	if ( !is_pure( node->left, count ) || !is_pure( node->right, count ) )
+		return false;
+
+	for ( auto child : node->children )
+	{
+		if ( !is_pure( child, count ) )
+			return false;
+	}
+
+	return true;
+}
+
+static bool can_inline( Optimiser *optimiser, InlineCandidate &candidate )
+{
+	if ( candidate.decls != 1 || candidate.uses != 0 )
+		return false;
+
+	Node *declFunc = candidate.declFunc;
+
+	if ( declFunc->children.size() != 1 || declFunc->children[ 0 ]->type != NodeID::Return || !declFunc->children[ 0 ]->left )
+		return false;
+
+	for ( auto param : params_of( declFunc ) )
+	{
+		if ( param->value.valueString == "self" || !param->children.empty() )
+			return false;
+	}
+
+	u32 count = 0;
+	Node *expr = declFunc->children[ 0 ]->left;
+
+	if ( !is_pure( expr, &count ) || count > optimiser->inlineMaxNodes )
+		return false;
+
+	// A returned variable that isn't a parameter may be a reference the caller
+	// keeps using, the call would hand it back without copying
+	if ( expr->type == NodeID::Identifier && !expr->left && expr->children.empty() && expr->value.valueString != "self" )
+	{
+		bool isParam = false;
+		for ( auto param : params_of( declFunc ) )
+			isParam |= ( param->value.valueString == expr->value.valueString );
+		if ( !isParam )
+			return false;
+	}
+
+	// A call binds its arguments one at a time in the callee's scope, so an
+	// argument naming a parameter reads the one bound before it, and self or
+	// any other name the body reads may not be what the caller sees. Call
+	// sites with arguments naming any of these are left as calls.
+	candidate.names.clear();
+	for ( auto param : params_of( declFunc ) )
+		candidate.names.push_back( param->value.valueString );
+	read_names( expr, &candidate.names );
+
+	return true;
+}
+
+// Clones the function expression, with parameters replaced by the argument expressions
+static Node *substitute( Node *node, Node *declFunc, Node *callNode )
+{
+	if ( !node )
+		return nullptr;
+
+	if ( node->type == NodeID::Identifier && !node->left )
+	{
+		const std::vector<Node*> &params = params_of( declFunc );
+
+		for ( u64 argIdx = 0, argCount = params.size(); argIdx < argCount; ++argIdx )
+		{
+			if ( params[ argIdx ]->value.valueString != node->value.valueString )
+				continue;
+
+			Node *arg = callNode->children[ argIdx ];
+
+			if ( node->children.empty() )
+				return clone_node( arg );
+
+			// a field of the parameter, can chain on from a plain variable
+			if ( arg->type != NodeID::Identifier || arg->left )
+				return nullptr;
+
+			Node *clone = clone_node( arg );
+			for ( auto child : node->children )
+				clone->children.push_back( clone_node( child ) );
+			return clone;
+		}
+	}
+
+	Node *clone = new Node;
+	clone->type = node->type;
+	clone->token = node->token;
+	clone->value = node->value;
+	clone->scope = node->scope;
+	clone->left = nullptr;
+	clone->right = nullptr;
+
+	bool failed = false;
+
+	if ( node->left )
+	{
+		clone->left = substitute( node->left, declFunc, callNode );
+		failed |= !clone->left;
+	}
+
+	if ( node->right )
+	{
+		clone->right = substitute( node->right, declFunc, callNode );
+		failed |= !clone->right;
+	}
+
+	for ( auto child : node->children )
+	{
+		Node *childClone = substitute( child, declFunc, callNode );
+		failed |= !childClone;
+		clone->children.push_back( childClone );
+	}
+
+	if ( failed )
+	{
+		// release the partial clone, it is not reachable from the tree
+		free_node( clone );
+		return nullptr;
+	}
+
+	return clone;
+}
+
+static Node *inline_call( Optimiser *optimiser, Node *callNode )
+{
+	Node *calleeNode = callNode->left;
+
+	if ( calleeNode->type != NodeID::Identifier || calleeNode->left )
+		return nullptr;
+
+	auto it = optimiser->candidates.find( last_name( calleeNode ) );
+	if ( it == optimiser->candidates.end() || !it->second.declFunc )
+		return nullptr;
+
+	InlineCandidate &candidate = it->second;
+	Node *declFunc = candidate.declFunc;
+
+	// argument count errors are left for the call to report
+	if ( callNode->children.size() != params_of( declFunc ).size() )
+		return nullptr;
+
+	std::vector<std::string> argNames;
+	for ( auto arg : callNode->children )
+	{
+		u32 count = 0;
+		if ( !is_pure( arg, &count ) )
+			return nullptr;
+		read_names( arg, &argNames );
+	}
+
+	for ( const std::string &name : argNames )
+	{
+		if ( std::find( candidate.names.begin(), candidate.names.end(), name ) != candidate.names.end() )
+			return nullptr;
+	}
+
+	Node *expr = substitute( declFunc->children[ 0 ]->left, declFunc, callNode );
+	if ( !expr )
+		return nullptr;
+
+	Node *inlined = new Node;
+	inlined->type = NodeID::InlinedCall;
+	inlined->token = callNode->token;
+	inlined->value = declFunc;
+	inlined->left = callNode;
+	inlined->right = expr;
+	inlined->scope = callNode->scope;
+
+	return inlined;
+}
+
+static void optimiser_inline( Optimiser *optimiser, Node *&node, u32 *changes )
+{
+	if ( !node )
+		return;
+
+	optimiser_inline( optimiser, node->left, changes );
+	optimiser_inline( optimiser, node->right, changes );
+	for ( auto &child : node->children )
+		optimiser_inline( optimiser, child, changes );
+
+	if ( node->type == NodeID::FunctionCall )
+	{
+		Node *inlined = inline_call( optimiser, node );
+		if ( inlined )
+		{
+			node = inlined;
+			*changes += 1;
+		}
+	}
+}
+
+static bool is_statement_list( Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Entry:
+	case NodeID::Block:
+	case NodeID::DeclFunc:
+	case NodeID::If:
+	case NodeID::IfCompare:
+	case NodeID::ForNumberRange:
+	case NodeID::ForOfIdentifier:
+	case NodeID::ForOfIdentifierRange:
+	case NodeID::ForOfIdentifierRangeCount:
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		return true;
+	}
+
+	return false;
+}
+
+static void optimiser_strip_asserts( Node *node, u32 *changes )
+{
+	if ( !node )
+		return;
+
+	if ( is_statement_list( node ) )
+	{
+		std::erase_if( node->children, [changes]( Node *child )
+		{
+			if ( child->type != NodeID::Assert )
+				return false;
+			free_node( child );
+			*changes += 1;
+			return true;
+		} );
+	}
+
+	optimiser_strip_asserts( node->left, changes );
+	optimiser_strip_asserts( node->right, changes );
+	for ( auto child : node->children )
+		optimiser_strip_asserts( child, changes );
+}
+
+static void optimiser_dead_code( Node *node, u32 *changes )
+{
+	if ( !node )
+		return;
+
+	if ( is_statement_list( node ) )
+	{
+		for ( u64 i = 0, count = node->children.size(); i < count; ++i )
+		{
+			switch ( node->children[ i ]->type )
+			{
+			case NodeID::Return:
+			case NodeID::Break:
+			case NodeID::Continue:
+			case NodeID::Exit:
+				// nothing after this statement can run
+				for ( u64 dead = i + 1; dead < count; ++dead )
+				{
+					free_node( node->children[ dead ] );
+					*changes += 1;
+				}
+				node->children.resize( i + 1 );
+				count = i + 1;
+				break;
+			}
+		}
+	}
+
+	optimiser_dead_code( node->left, changes );
+	optimiser_dead_code( node->right, changes );
+	for ( auto child : node->children )
+		optimiser_dead_code( child, changes );
+}
+
+static bool is_comparison( Node *node )
+{
+	if ( node->type != NodeID::Operation )
+		return false;
+
+	switch ( node->token->id )
+	{
+	case TokenID::DoubleAssign:
+	case TokenID::ExclamationAssign:
+	case TokenID::GreaterThan:
+	case TokenID::GreaterOrEqual:
+	case TokenID::LesserThan:
+	case TokenID::LesserOrEqual:
+		return true;
+	}
+
+	return false;
+}
+
+// Swaps frequent node shapes for fused node kinds with an integer fast path
+static void optimiser_superinstructions( Node *node, u32 *changes )
+{
+	if ( !node )
+		return;
+
+	switch ( node->type )
+	{
+	case NodeID::AssignmentOp:
+		if ( ( node->token->id == TokenID::PlusAssign || node->token->id == TokenID::MinusAssign ) &&
+			node->right->type == NodeID::Number && node->right->value.type == ValueType::NumberI64 )
+		{
+			node->type = NodeID::AssignmentOpConst;
+			*changes += 1;
+		}
+		break;
+
+	case NodeID::If:
+		if ( is_comparison( node->left ) )
+		{
+			node->type = NodeID::IfCompare;
+			*changes += 1;
+		}
+		break;
+
+	case NodeID::While:
+		if ( is_comparison( node->left ) )
+		{
+			node->type = NodeID::WhileCompare;
+			*changes += 1;
+		}
+		break;
+	}
+
+	optimiser_superinstructions( node->left, changes );
+	optimiser_superinstructions( node->right, changes );
+	for ( auto child : node->children )
+		optimiser_superinstructions( child, changes );
+}
+
+// Array literals made only of constants are built once into the node's value.
+// A loop source uses the folded array in place, everywhere else it is copied
+// instead of rebuilt. Loop sources that aren't constant use the interpreter's
+// arena instead, see Interpreter::loop_source.
+static bool is_constant_literal( Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Number:
+	case NodeID::StringLiteral:
+		return true;
+	case NodeID::CreateArray:
+		return node->value.type == ValueType::Arr;
+	}
+
+	return false;
+}
+
+static void optimiser_fold_arrays( Node *node, u32 *changes )
+{
+	if ( !node )
+		return;
+
+	optimiser_fold_arrays( node->left, changes );
+	optimiser_fold_arrays( node->right, changes );
+	for ( auto child : node->children )
+		optimiser_fold_arrays( child, changes );
+
+	if ( node->type != NodeID::CreateArray || node->value.type == ValueType::Arr )
+		return;
+
+	for ( auto child : node->children )
+	{
+		if ( !is_constant_literal( child ) )
+			return;
+	}
+
+	Value arr( ValueType::Arr );
+	for ( auto child : node->children )
+		arr.array_push( child->value );
+	node->value = std::move( arr );
+	*changes += 1;
+}
+
+// -- type inference --
+// Variables are dynamically scoped and any call can assign any of them, so
+// types are tracked per name over the whole program. A name is proven when
+// every write to it, from any scope, gives the same type.
+
+// every bit set, so it covers each ValueType however many there are
+constexpr u32 TypeUnknown = ~0u;
+
+struct TypeFunction
+{
+	Node *declFunc;
+	u32 decls;
+	bool escapes;
+	u32 returns;
+};
+
+struct TypeInference
+{
+	std::unordered_map<std::string, u32> names;
+	std::unordered_map<std::string, TypeFunction> functions;
+	bool changed;
+	u32 annotated;
+};
+
+static u32 type_bit( ValueType type )
+{
+	return 1u << static_cast<u32>( type );
+}
+
+static bool type_is_name( Node *node )
+{
+	return ( node->type == NodeID::Identifier || node->type == NodeID::CreateIdentifier ) &&
+		!node->left && node->children.empty() && node->value.valueString != "self";
+}
+
+static void type_join( TypeInference *ti, u32 *mask, u32 type )
+{
+	if ( ( *mask | type ) != *mask )
+	{
+		*mask |= type;
+		ti->changed = true;
+	}
+}
+
+static void type_join( TypeInference *ti, const std::string &name, u32 type )
+{
+	type_join( ti, &ti->names[ name ], type );
+}
+
+// Result of an arithmetic operator for every pairing of the operand types, as
+// the TYPE_PAIR tables in value.cpp give them. Anything else is fatal there.
+static u32 type_arithmetic( u32 lhs, u32 rhs )
+{
+	constexpr ValueType operands[] = { ValueType::NumberI32, ValueType::NumberI64, ValueType::StringLiteral };
+
+	u32 result = 0;
+	for ( ValueType l : operands )
+	{
+		if ( !( lhs & type_bit( l ) ) )
+			continue;
+
+		for ( ValueType r : operands )
+		{
+			if ( !( rhs & type_bit( r ) ) )
+				continue;
+
+			if ( l == ValueType::StringLiteral || r == ValueType::StringLiteral )
+				result |= type_bit( l );
+			else if ( l == ValueType::NumberI32 && r == ValueType::NumberI32 )
+				result |= type_bit( ValueType::NumberI32 );
+			else
+				result |= type_bit( ValueType::NumberI64 );
+		}
+	}
+	return result;
+}
+
+static TypeFunction *type_function( TypeInference *ti, Node *callee )
+{
+	if ( !type_is_name( callee ) )
+		return nullptr;
+
+	auto it = ti->functions.find( callee->value.valueString );
+	if ( it == ti->functions.end() || it->second.decls != 1 || it->second.escapes )
+		return nullptr;
+
+	// the name may also be assigned something other than the function
+	if ( ti->names[ callee->value.valueString ] != type_bit( ValueType::Node ) )
+		return nullptr;
+
+	return &it->second;
+}
+
+static u32 type_of( TypeInference *ti, Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Number:
+		return type_bit( node->value.type );
+
+	case NodeID::StringLiteral:
+		return type_bit( ValueType::StringLiteral );
+
+	case NodeID::Identifier:
+	case NodeID::CreateIdentifier:
+		return type_is_name( node ) ? ti->names[ node->value.valueString ] : TypeUnknown;
+
+	case NodeID::Operation:
+		{
+			u32 lhs = type_of( ti, node->left );
+			u32 rhs = type_of( ti, node->right );
+			if ( is_comparison( node ) )
+				return ( lhs && rhs ) ? type_bit( ValueType::NumberI32 ) : 0;
+			return type_arithmetic( lhs, rhs );
+		}
+
+	case NodeID::CreateArray:
+		return type_bit( ValueType::Arr );
+
+	case NodeID::CreateStruct:
+		return type_bit( ValueType::Struct );
+
+	case NodeID::FunctionCall:
+		{
+			TypeFunction *function = type_function( ti, node->left );
+			return function ? function->returns : TypeUnknown;
+		}
+
+	case NodeID::InlinedCall:
+		return type_of( ti, node->left ) | type_of( ti, node->right );
+	}
+
+	return TypeUnknown;
+}
+
+// Finds the functions that are only ever called by their plain name, those
+// get their parameter types from the call sites
+static void type_collect( TypeInference *ti, Node *node, bool callee = false )
+{
+	if ( !node )
+		return;
+
+	switch ( node->type )
+	{
+	case NodeID::DeclFunc:
+		{
+			TypeFunction &function = ti->functions[ last_name( node->left ) ];
+			function.declFunc = node;
+			function.decls += 1;
+			for ( auto child : node->children )
+				type_collect( ti, child );
+		}
+		return;
+
+	case NodeID::FunctionCall:
+		type_collect( ti, node->left, true );
+		for ( auto child : node->children )
+			type_collect( ti, child );
+		return;
+
+	case NodeID::Identifier:
+	case NodeID::CreateIdentifier:
+		if ( !callee || !type_is_name( node ) )
+		{
+			ti->functions[ node->value.valueString ].escapes = true;
+			for ( auto child : node->children )
+				ti->functions[ child->value.valueString ].escapes = true;
+		}
+		type_collect( ti, node->left );
+		return;
+	}
+
+	type_collect( ti, node->left );
+	type_collect( ti, node->right );
+	for ( auto child : node->children )
+		type_collect( ti, child );
+}
+
+static void type_walk( TypeInference *ti, Node *node, TypeFunction *function )
+{
+	if ( !node )
+		return;
+
+	switch ( node->type )
+	{
+	case NodeID::Assignment:
+		if ( type_is_name( node->left ) )
+			type_join( ti, node->left->value.valueString, type_of( ti, node->right ) );
+		else if ( node->left->type == NodeID::Identifier || node->left->type == NodeID::CreateIdentifier )
+			type_join( ti, last_name( node->left ), TypeUnknown );
+		break;
+
+	case NodeID::AssignmentOp:
+	case NodeID::AssignmentOpConst:
+		if ( type_is_name( node->left ) )
+		{
+			const std::string &name = node->left->value.valueString;
+			type_join( ti, name, type_arithmetic( ti->names[ name ], type_of( ti, node->right ) ) );
+		}
+		else if ( node->left->type == NodeID::Identifier || node->left->type == NodeID::CreateIdentifier )
+		{
+			type_join( ti, last_name( node->left ), TypeUnknown );
+		}
+		break;
+
+	case NodeID::DeclFunc:
+		{
+			const std::string &name = last_name( node->left );
+			type_join( ti, name, type_bit( ValueType::Node ) );
+
+			TypeFunction *declared = &ti->functions[ name ];
+			if ( declared->decls != 1 || declared->escapes )
+			{
+				for ( auto param : params_of( node ) )
+					type_join( ti, param->value.valueString, TypeUnknown );
+				declared = nullptr;
+			}
+
+			for ( auto child : node->children )
+				type_walk( ti, child, declared );
+		}
+		return;
+
+	case NodeID::FunctionCall:
+		{
+			TypeFunction *callee = type_function( ti, node->left );
+			if ( callee )
+			{
+				const std::vector<Node*> &params = params_of( callee->declFunc );
+				for ( u64 i = 0; i < params.size() && i < node->children.size(); ++i )
+					type_join( ti, params[ i ]->value.valueString, type_of( ti, node->children[ i ] ) );
+			}
+		}
+		break;
+
+	case NodeID::Return:
+		if ( function )
+			type_join( ti, &function->returns, node->left ? type_of( ti, node->left ) : type_bit( node->value.type ) );
+		break;
+
+	case NodeID::ForNumberRange:
+		if ( type_is_name( node->left ) )
+			type_join( ti, node->left->value.valueString, type_bit( ValueType::NumberI64 ) );
+		else
+			type_join( ti, last_name( node->left ), TypeUnknown );
+		break;
+
+	case NodeID::ForOfIdentifier:
+	case NodeID::ForOfIdentifierRange:
+	case NodeID::ForOfIdentifierRangeCount:
+		type_join( ti, last_name( node->left ), TypeUnknown );
+		break;
+
+	case NodeID::Import:
+		type_join( ti, node->left->value.valueString, TypeUnknown );
+		break;
+	}
+
+	type_walk( ti, node->left, function );
+	type_walk( ti, node->right, function );
+	for ( auto child : node->children )
+		type_walk( ti, child, function );
+}
+
+static void type_annotate( TypeInference *ti, Node *node )
+{
+	if ( !node )
+		return;
+
+	switch ( node->type )
+	{
+	case NodeID::Number:
+	case NodeID::StringLiteral:
+	case NodeID::Identifier:
+	case NodeID::CreateIdentifier:
+	case NodeID::Operation:
+	case NodeID::FunctionCall:
+	case NodeID::InlinedCall:
+		{
+			u32 type = type_of( ti, node );
+			if ( std::has_single_bit( type ) )
+			{
+				node->staticType = static_cast<ValueType>( std::countr_zero( type ) );
+				ti->annotated += 1;
+			}
+		}
+		break;
+	}
+
+	type_annotate( ti, node->left );
+	type_annotate( ti, node->right );
+	for ( auto child : node->children )
+		type_annotate( ti, child );
+}
+
+static std::string type_names( u32 mask )
+{
+	if ( mask == TypeUnknown )
+		return "any";
+
+	std::string names;
+	for ( u32 bits = mask; bits; bits &= bits - 1 )
+		names += std::format( "{}{}", names.empty() ? "" : " | ", static_cast<ValueType>( std::countr_zero( bits ) ) );
+	return names;
+}
+
+static u32 pass_strip_asserts( Optimiser *optimiser, Node *root )
+{
+	(void)optimiser;
+	u32 changes = 0;
+	optimiser_strip_asserts( root, &changes );
+	return changes;
+}
+
+static u32 pass_dead_code( Optimiser *optimiser, Node *root )
+{
+	(void)optimiser;
+	u32 changes = 0;
+	optimiser_dead_code( root, &changes );
+	return changes;
+}
+
+static u32 pass_inline( Optimiser *optimiser, Node *root )
+{
+	if ( optimiser->inlineMaxNodes == 0 )
+		return 0;
+
+	optimiser_collect( optimiser, root );
+
+	for ( auto it = optimiser->candidates.begin(); it != optimiser->candidates.end(); )
+	{
+		if ( can_inline( optimiser, it->second ) )
+			++it;
+		else
+			it = optimiser->candidates.erase( it );
+	}
+
+	u32 changes = 0;
+	optimiser_inline( optimiser, root, &changes );
+	return changes;
+}
+
+static u32 pass_superinstructions( Optimiser *optimiser, Node *root )
+{
+	(void)optimiser;
+	u32 changes = 0;
+	optimiser_superinstructions( root, &changes );
+	return changes;
+}
+
+static u32 pass_fold_arrays( Optimiser *optimiser, Node *root )
+{
+	(void)optimiser;
+	u32 changes = 0;
+	optimiser_fold_arrays( root, &changes );
+	return changes;
+}
+
+static u32 pass_types( Optimiser *optimiser, Node *root )
+{
+	TypeInference ti;
+	ti.annotated = 0;
+
+	// set by the interpreter itself
+	for ( const char *name : { "self", "lidx", "parent" } )
+		ti.names[ name ] = TypeUnknown;
+
+	type_collect( &ti, root );
+
+	// types only widen, so this settles
+	do
+	{
+		ti.changed = false;
+		type_walk( &ti, root, nullptr );
+	}
+	while ( ti.changed );
+
+	type_annotate( &ti, root );
+
+	if ( optimiser->report )
+	{
+		std::vector<std::string> polymorphic;
+		for ( auto &[ name, mask ] : ti.names )
+		{
+			if ( std::popcount( mask ) > 1 && name != "self" && name != "lidx" && name != "parent" )
+				polymorphic.push_back( name );
+		}
+		std::ranges::sort( polymorphic );
+		for ( const std::string &name : polymorphic )
+			std::println( stderr, "[Optimiser] polymorphic {} ( {} )", name, type_names( ti.names[ name ] ) );
+	}
+
+	return ti.annotated;
+}
+
+// Passes run in this order, each one from its level up
+static constexpr OptimiserPass OptimiserPasses[] =
+{
+	{
+		.name = "strip-asserts",
+		.level = 2,
+		.run = pass_strip_asserts,
+	},
+	{
+		.name = "dead-code",
+		.level = 1,
+		.run = pass_dead_code,
+	},
+	{
+		.name = "inline",
+		.level = 1,
+		.run = pass_inline,
+	},
+	{
+		.name = "superinstr",
+		.level = 1,
+		.run = pass_superinstructions,
+	},
+	{
+		.name = "fold-arrays",
+		.level = 1,
+		.run = pass_fold_arrays,
+	},
+	{
+		.name = "types",
+		.level = 1,
+		.run = pass_types,
+	},
+};
+
+void Optimiser::run( Node *root )
+{
+	for ( const OptimiserPass &pass : OptimiserPasses )
+	{
+		if ( level < pass.level )
+			continue;
+
+		auto start = std::chrono::steady_clock::now();
+		u32 changes = pass.run( this, root );
+		auto end = std::chrono::steady_clock::now();
+
+		if ( report )
+			std::println( stderr, "[Optimiser] {:<14} {:>6} changes {:>10.3f} ms", pass.name, changes, std::chrono::duration<f64, std::milli>( end - start ).count() );
+	}
+}
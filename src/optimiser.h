@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "parser.h"
+
+// Largest return expression, in nodes, that gets inlined at a call site
+constexpr u32 InlineMaxNodesDefault = 16;
+
+struct InlineCandidate
+{
+	Node *declFunc;
+	u32 decls;
+	u32 uses;
+	// parameters and variables the body reads, see can_inline
+	std::vector<std::string> names;
+};
+
+struct Optimiser;
+
+struct OptimiserPass
+{
+	const char *name;
+	i32 level;
+	u32 (*run)( Optimiser *optimiser, Node *root );
+};
+
+struct Optimiser
+{
+	void run( Node *root );
+
+	std::unordered_map<std::string, InlineCandidate> candidates;
+	i32 level = 1;
+	bool report = false;
+	u32 inlineMaxNodes = InlineMaxNodesDefault;
+};
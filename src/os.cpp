@@ -1,7 +1,696 @@
 
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <print>
+#include <unordered_set>
 
 #include "os.h"
+#include "interpreter.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+	#include <fcntl.h>
+	#include <io.h>
+	#include <share.h>
+	#include <sys/stat.h>
+#else
+	#include <cerrno>
+	#include <climits>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+// -- descriptors --
+
+// Flags for a file opened to read, write or both. Writing creates it.
+static i32 open_flags( bool reading, bool writing, bool truncate, bool append )
+{
+#ifdef _WIN32
+	i32 flags = ( reading && writing ? _O_RDWR : ( writing ? _O_WRONLY : _O_RDONLY ) ) | _O_BINARY;
+	if ( writing )
+		flags |= _O_CREAT;
+	if ( truncate )
+		flags |= _O_TRUNC;
+	if ( append )
+		flags |= _O_APPEND;
+#else
+	i32 flags = ( reading && writing ? O_RDWR : ( writing ? O_WRONLY : O_RDONLY ) ) | O_CLOEXEC;
+	if ( writing )
+		flags |= O_CREAT;
+	if ( truncate )
+		flags |= O_TRUNC;
+	if ( append )
+		flags |= O_APPEND;
+#endif
+	return flags;
+}
+
+static i32 fd_open( const std::string &path, i32 flags )
+{
+#ifdef _WIN32
+	i32 fd = -1;
+	if ( _sopen_s( &fd, path.c_str(), flags, _SH_DENYNO, _S_IREAD | _S_IWRITE ) != 0 )
+		return -1;
+	return fd;
+#else
+	return open( path.c_str(), flags, 0644 );
+#endif
+}
+
+// Bytes read, 0 at the end and below 0 on an error
+static i64 fd_read( i32 fd, char *data, u64 size )
+{
+#ifdef _WIN32
+	return _read( fd, data, static_cast<u32>( std::min<u64>( size, 1u << 30 ) ) );
+#else
+	i64 got;
+	do
+		got = ::read( fd, data, size );
+	while ( got < 0 && errno == EINTR );
+	return got;
+#endif
+}
+
+// All of the bytes, false when the descriptor stopped taking them
+static bool fd_write( i32 fd, const char *data, u64 size )
+{
+	while ( size > 0 )
+	{
+#ifdef _WIN32
+		i64 put = _write( fd, data, static_cast<u32>( std::min<u64>( size, 1u << 30 ) ) );
+#else
+		i64 put = ::write( fd, data, size );
+		if ( put < 0 && errno == EINTR )
+			continue;
+#endif
+		if ( put <= 0 )
+			return false;
+		data += put;
+		size -= static_cast<u64>( put );
+	}
+	return true;
+}
+
+static void fd_skip( i32 fd, i64 offset )
+{
+#ifdef _WIN32
+	_lseeki64( fd, offset, SEEK_CUR );
+#else
+	lseek( fd, offset, SEEK_CUR );
+#endif
+}
+
+static i64 fd_size( i32 fd )
+{
+#ifdef _WIN32
+	return _filelengthi64( fd );
+#else
+	struct stat info;
+	return fstat( fd, &info ) == 0 ? static_cast<i64>( info.st_size ) : -1;
+#endif
+}
+
+static void fd_close( i32 fd )
+{
+#ifdef _WIN32
+	_close( fd );
+#else
+	::close( fd );
+#endif
+}
+
+// -- file handle --
+
+// Moves the unread bytes to the front and reads more after them, false when the file has no more
+bool FileHandle::fill()
+{
+	if ( writing )
+	{
+		write_output();
+		writing = false;
+	}
+
+	if ( buffer.empty() )
+		buffer.resize( FileBufferSize );
+
+	if ( start > 0 )
+	{
+		std::memmove( buffer.data(), buffer.data() + start, end - start );
+		end -= start;
+		start = 0;
+	}
+
+	// only a line longer than the buffer grows it
+	if ( end == buffer.size() )
+		buffer.resize( buffer.size() * 2 );
+
+	i64 got = fd_read( fd, buffer.data() + end, buffer.size() - end );
+	if ( got <= 0 )
+		return false;
+	end += static_cast<u64>( got );
+	return true;
+}
+
+// Up to size bytes, false when there was nothing left to read
+bool FileHandle::read( u64 size, std::string &out )
+{
+	while ( end - start < size )
+	{
+		if ( !fill() )
+			break;
+	}
+
+	if ( start == end )
+		return false;
+
+	u64 count = std::min( size, end - start );
+	out.assign( buffer.data() + start, count );
+	start += count;
+	return true;
+}
+
+// The bytes before the next delim, which is consumed, or the rest of the file
+// when there isn't one. False when there was nothing left to read.
+bool FileHandle::read_until( char delim, std::string &out )
+{
+	u64 searched = 0;
+
+	for ( ;; )
+	{
+		u64 from = start + searched;
+		const void *at = ( from < end ? std::memchr( buffer.data() + from, delim, end - from ) : nullptr );
+		if ( at )
+		{
+			u64 found = static_cast<u64>( static_cast<const char *>( at ) - buffer.data() );
+			out.assign( buffer.data() + start, found - start );
+			start = found + 1;
+			return true;
+		}
+
+		searched = end - start;
+		if ( !fill() )
+			break;
+	}
+
+	if ( start == end )
+		return false;
+
+	out.assign( buffer.data() + start, end - start );
+	start = end;
+	return true;
+}
+
+// A line without its line break, into storage out may already have
+bool FileHandle::read_line( std::string &out )
+{
+	if ( !read_until( '\n', out ) )
+		return false;
+	if ( !out.empty() && out.back() == '\r' )
+		out.pop_back();
+	return true;
+}
+
+void FileHandle::read_rest( std::string &out )
+{
+	for ( bool more = true; more; )
+		more = fill();
+
+	out.assign( buffer.data() + start, end - start );
+	start = end;
+}
+
+bool FileHandle::at_end()
+{
+	return start == end && !fill();
+}
+
+// Gives back the bytes read ahead, so the descriptor is where the script is
+// before it writes
+void FileHandle::unread()
+{
+	if ( writing || standardInput )
+		return;
+
+	if ( end > start )
+		fd_skip( fd, -static_cast<i64>( end - start ) );
+	start = 0;
+	end = 0;
+}
+
+// Gathered until the buffer is full. A write that would fill it on its own
+// goes to the descriptor directly. False when the descriptor refused what it
+// was given, gathered bytes included.
+bool FileHandle::write( const char *data, u64 size )
+{
+	if ( !writing )
+	{
+		unread();
+		writing = true;
+	}
+
+	if ( output.size() + size > WriteBufferSize )
+	{
+		if ( !write_output() )
+			return false;
+		if ( size >= WriteBufferSize )
+			return fd_write( fd, data, size );
+	}
+
+	if ( output.capacity() < WriteBufferSize )
+		output.reserve( WriteBufferSize );
+	output.append( data, size );
+	return true;
+}
+
+// Parts that fit are gathered like any write. More than the buffer holds go
+// to the descriptor in one vectored write, after what was gathered before them.
+bool FileHandle::write_parts( const std::vector<std::string_view> &parts )
+{
+	u64 size = 0;
+	for ( std::string_view part : parts )
+		size += part.size();
+
+	if ( output.size() + size <= WriteBufferSize )
+	{
+		for ( std::string_view part : parts )
+		{
+			if ( !write( part.data(), part.size() ) )
+				return false;
+		}
+		return true;
+	}
+
+	if ( !writing )
+	{
+		unread();
+		writing = true;
+	}
+	if ( !write_output() )
+		return false;
+
+#ifdef _WIN32
+	for ( std::string_view part : parts )
+	{
+		if ( !fd_write( fd, part.data(), part.size() ) )
+			return false;
+	}
+	return true;
+#else
+	std::vector<iovec> vectors;
+	vectors.reserve( std::min<u64>( parts.size(), IOV_MAX ) );
+
+	for ( u64 at = 0; at < parts.size(); )
+	{
+		vectors.clear();
+		for ( ; at < parts.size() && vectors.size() < IOV_MAX; ++at )
+		{
+			if ( !parts[ at ].empty() )
+				vectors.push_back( { const_cast<char *>( parts[ at ].data() ), parts[ at ].size() } );
+		}
+
+		// a short write carries on from the part it stopped in
+		for ( u64 next = 0; next < vectors.size(); )
+		{
+			i64 put = writev( fd, vectors.data() + next, static_cast<i32>( vectors.size() - next ) );
+			if ( put < 0 && errno == EINTR )
+				continue;
+			if ( put <= 0 )
+				return false;
+
+			u64 left = static_cast<u64>( put );
+			while ( next < vectors.size() && left >= vectors[ next ].iov_len )
+				left -= vectors[ next++ ].iov_len;
+			if ( next < vectors.size() )
+			{
+				vectors[ next ].iov_base = static_cast<char *>( vectors[ next ].iov_base ) + left;
+				vectors[ next ].iov_len -= left;
+			}
+		}
+	}
+	return true;
+#endif
+}
+
+bool FileHandle::write_output()
+{
+	if ( output.empty() )
+		return true;
+	bool written = fd_write( fd, output.data(), output.size() );
+	output.clear();
+	return written;
+}
+
+// Everything written so far, handed to the descriptor
+bool FileHandle::flush()
+{
+	if ( !is_open() )
+		return false;
+	return write_output();
+}
+
+// The size on disk, including what was gathered to write
+i64 FileHandle::size()
+{
+	flush();
+	return fd_size( fd );
+}
+
+// Flushed, closed and ready to be opened again with its buffers
+void FileHandle::close()
+{
+	if ( !is_open() )
+		return;
+
+	flush();
+	if ( !standardInput )
+		fd_close( fd );
+
+	fd = -1;
+	path.clear();
+	start = 0;
+	end = 0;
+	writing = false;
+	standardInput = false;
+	closeAtEnd = false;
+}
+
+// Handles still open when the process exits, there or through exit, have what
+// they gathered written out then
+static std::unordered_set<FileHandle *> &live_file_handles()
+{
+	static std::unordered_set<FileHandle *> handles;
+	return handles;
+}
+
+static void flush_file_handles()
+{
+	for ( FileHandle *handle : live_file_handles() )
+		handle->flush();
+}
+
+FileHandle::FileHandle()
+{
+	live_file_handles().insert( this );
+	static bool flushAtExit = ( std::atexit( flush_file_handles ) == 0 );
+	(void)flushAtExit;
+}
+
+FileHandle::~FileHandle()
+{
+	close();
+	live_file_handles().erase( this );
+}
+
+// -- file table --
+
+FileId FileTable::open( const std::string &path, i32 fd, bool standardInput )
+{
+	u32 slot;
+	if ( !freeSlots.empty() )
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		slot = static_cast<u32>( slots.size() );
+		slots.emplace_back();
+		slots.back().handle = std::make_unique<FileHandle>();
+	}
+
+	FileHandle &handle = *slots[ slot ].handle;
+	handle.fd = fd;
+	handle.path = path;
+	handle.standardInput = standardInput;
+	return ( static_cast<u64>( slots[ slot ].generation ) << 32 ) | ( slot + 1 );
+}
+
+// One handle for stdin however often it is asked for, so what one loop read
+// ahead is there for the next
+FileId FileTable::standard_input()
+{
+	if ( !get( stdinId ) )
+		stdinId = open( "stdin", 0, true );
+	return stdinId;
+}
+
+FileHandle *FileTable::get( FileId id ) const
+{
+	u64 slot = ( id & 0xffffffff ) - 1;
+	if ( id == 0 || slot >= slots.size() || slots[ slot ].generation != ( id >> 32 ) )
+		return nullptr;
+
+	FileHandle *handle = slots[ slot ].handle.get();
+	return handle->is_open() ? handle : nullptr;
+}
+
+// False when the id was already closed
+bool FileTable::close( FileId id )
+{
+	FileHandle *handle = get( id );
+	if ( !handle )
+		return false;
+
+	u32 slot = static_cast<u32>( ( id & 0xffffffff ) - 1 );
+	handle->close();
+	slots[ slot ].generation += 1;
+	freeSlots.push_back( slot );
+	return true;
+}
+
+// Files the script never closed are reported, then flushed and closed
+void FileTable::cleanup()
+{
+	for ( Slot &slot : slots )
+	{
+		FileHandle &handle = *slot.handle;
+		if ( handle.is_open() && !handle.standardInput )
+			std::println( stderr, "[Interpreter] File left open: {}", handle.path );
+		handle.close();
+	}
+
+	slots.clear();
+	freeSlots.clear();
+	stdinId = 0;
+}
+
+// -- mapped files --
+
+MappedFile::~MappedFile()
+{
+	if ( !data )
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile( data );
+#else
+	munmap( const_cast<char *>( data ), size );
+#endif
+}
+
+// Null when the file can't be opened or mapped. The mapping outlives the handles used to make it.
+std::shared_ptr<MappedFile> map_file( const std::string &path )
+{
+	std::error_code error;
+	u64 size = std::filesystem::file_size( path, error );
+	if ( error )
+		return nullptr;
+
+	auto mapped = std::make_shared<MappedFile>();
+	if ( size == 0 )
+		return mapped;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+	if ( file == INVALID_HANDLE_VALUE )
+		return nullptr;
+
+	HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	void *view = mapping ? MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : nullptr;
+	if ( mapping )
+		CloseHandle( mapping );
+	CloseHandle( file );
+	if ( !view )
+		return nullptr;
+#else
+	i32 fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+		return nullptr;
+
+	void *view = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( view == MAP_FAILED )
+		return nullptr;
+	madvise( view, size, MADV_SEQUENTIAL );
+#endif
+
+	mapped->data = static_cast<const char *>( view );
+	mapped->size = size;
+	return mapped;
+}
+
+// The line from at, without its line break, and at moved past it
+bool ByteView::next_line( u64 &at, std::string_view &line ) const
+{
+	if ( at >= bytes.size() )
+		return false;
+
+	u64 end = bytes.find( '\n', at );
+	u64 next = ( end == std::string_view::npos ? bytes.size() : end + 1 );
+	line = bytes.substr( at, ( end == std::string_view::npos ? bytes.size() : end ) - at );
+	if ( !line.empty() && line.back() == '\r' )
+		line.remove_suffix( 1 );
+	at = next;
+	return true;
+}
+
+Value bytes_value( std::shared_ptr<MappedFile> mapping, std::string_view bytes )
+{
+	ByteView *view = new ByteView;
+	view->mapping = std::move( mapping );
+	view->bytes = bytes;
+
+	Value ret( ValueType::Bytes );
+	ret.collection = view;
+	return ret;
+}
+
+static Value file_value( const std::string &path, FileId id )
+{
+	Value ret( ValueType::File );
+	ret.valueString = path;
+	ret.fileId = id;
+	return ret;
+}
+
+static FileHandle &expect_file( Interpreter *interpreter, Node *args, Value &value, const char *name )
+{
+	if ( value.type != ValueType::File )
+		interpreter->fatal( RESULT_CODE_VALUE_NOT_A_FILE, args, "{} called on a value that is not a file.", name );
+	FileHandle *handle = interpreter->fileTable.get( value.fileId );
+	if ( !handle )
+		interpreter->fatal( RESULT_CODE_VALUE_NOT_A_FILE, args, "{} called on a closed file.", name );
+	return *handle;
+}
+
+static i64 write_number( FileHandle &handle, i64 number )
+{
+	char digits[ 24 ];
+	auto result = std::to_chars( digits, digits + sizeof( digits ), number );
+	i64 size = static_cast<i64>( result.ptr - digits );
+	return handle.write( digits, static_cast<u64>( size ) ) ? size : -1;
+}
+
+// Characters of the longest i64
+constexpr u64 MaxDigits = 20;
+
+// An array's entries as text, nested arrays flattened. Numbers are formatted
+// into digits, reserved up front so the views of it stay put.
+struct ArrayParts
+{
+	std::vector<std::string_view> views;
+	std::string digits;
+	std::deque<std::string> converted;
+	u64 size = 0;
+};
+
+static u64 number_count( const Value &value )
+{
+	if ( value.array->packed )
+		return value.array->ints.size();
+
+	u64 count = 0;
+	for ( const Value &entry : value.array->values )
+	{
+		const Value &v = entry.deref();
+		if ( v.type == ValueType::NumberI32 || v.type == ValueType::NumberI64 )
+			count += 1;
+		else if ( v.type == ValueType::Arr )
+			count += number_count( v );
+	}
+	return count;
+}
+
+static void add_number( ArrayParts &parts, i64 number )
+{
+	u64 from = parts.digits.size();
+	parts.digits.resize( from + MaxDigits );
+	auto result = std::to_chars( parts.digits.data() + from, parts.digits.data() + from + MaxDigits, number );
+	u64 size = static_cast<u64>( result.ptr - ( parts.digits.data() + from ) );
+	parts.digits.resize( from + size );
+	parts.views.emplace_back( parts.digits.data() + from, size );
+	parts.size += size;
+}
+
+static void add_text( ArrayParts &parts, std::string_view text )
+{
+	parts.views.push_back( text );
+	parts.size += text.size();
+}
+
+static void add_parts( Interpreter *interpreter, Node *node, Value &value, ArrayParts &parts )
+{
+	if ( value.array->packed )
+	{
+		for ( i64 number : value.array->ints )
+			add_number( parts, number );
+		return;
+	}
+
+	for ( Value &entry : value.array->values )
+	{
+		Value &v = entry.deref();
+		if ( v.type == ValueType::NumberI32 )
+			add_number( parts, v.valueI32 );
+		else if ( v.type == ValueType::NumberI64 )
+			add_number( parts, v.valueI64 );
+		else if ( v.type == ValueType::Arr )
+			add_parts( interpreter, node, v, parts );
+		else if ( is_text( v.type ) )
+			add_text( parts, text_view( v ) );
+		else
+			add_text( parts, parts.converted.emplace_back( v.get_as_string( interpreter, node ) ) );
+	}
+}
+
+// Strings and byte views are written from where they are and numbers are
+// formatted without a string of their own. An array's entries are written one
+// after another in the same call, as one vectored write when they are large.
+// The bytes written, or -1 when the file couldn't be written.
+static i64 write_value( Interpreter *interpreter, Node *node, FileHandle &handle, Value &value )
+{
+	switch ( value.type )
+	{
+	case ValueType::NumberI32: return write_number( handle, value.valueI32 );
+	case ValueType::NumberI64: return write_number( handle, value.valueI64 );
+
+	case ValueType::Arr:
+		{
+			ArrayParts parts;
+			parts.digits.reserve( number_count( value ) * MaxDigits );
+			add_parts( interpreter, node, value, parts );
+			return handle.write_parts( parts.views ) ? static_cast<i64>( parts.size ) : -1;
+		}
+	}
+
+	if ( is_text( value.type ) )
+	{
+		std::string_view text = text_view( value );
+		return handle.write( text.data(), text.size() ) ? static_cast<i64>( text.size() ) : -1;
+	}
+
+	std::string text = value.get_as_string( interpreter, node );
+	return handle.write( text.data(), text.size() ) ? static_cast<i64>( text.size() ) : -1;
+}
+
+// -- script interface --
 
 Value BuiltInNode_Struct_OS_MkDir( Interpreter *interpreter, Value &self, Node *args )
 {
@@ -31,18 +720,23 @@ Value BuiltInNode_Struct_OS_Open( Interpreter *interpreter, Value &self, Node *a
 	(void)self;
 
 	std::string filename;
-	std::ios_base::openmode mode;
+	i32 flags;
+	Value *reopen = nullptr;
 
 	switch ( args->children.size() )
 	{
 	case 1:
 		{
 			Arg arg = &args->children[ 0 ];
-			filename = interpreter->run( arg ).get_as_string( interpreter, arg );
+			Value path = interpreter->run( arg );
+			filename = path.deref().get_as_string( interpreter, arg );
+			// a file variable that was closed is opened again in place
+			if ( path.type == ValueType::Reference && path.deref().type == ValueType::File )
+				reopen = &path.deref();
 			if ( std::filesystem::exists( filename ) )
-				mode = std::ios_base::in | std::ios_base::out;
+				flags = open_flags( true, true, false, false );
 			else
-				mode = std::ios_base::out;
+				flags = open_flags( false, true, true, false );
 		}
 		break;
 
@@ -50,7 +744,13 @@ Value BuiltInNode_Struct_OS_Open( Interpreter *interpreter, Value &self, Node *a
 		{
 			Arg arg = &args->children[ 0 ];
 			filename = interpreter->run( arg ).get_as_string( interpreter, arg.next() );
-			mode = (std::ios_base::openmode)interpreter->run( arg ).get_as_i32( interpreter, arg );
+			// the mode is a std::ios_base::openmode, as fstream took it
+			i32 mode = interpreter->run( arg ).get_as_i32( interpreter, arg );
+			bool reading = ( mode & std::ios_base::in ) != 0;
+			bool append = ( mode & std::ios_base::app ) != 0;
+			bool writing = ( mode & std::ios_base::out ) != 0 || append;
+			bool truncate = ( mode & std::ios_base::trunc ) != 0 || ( writing && !reading && !append );
+			flags = open_flags( reading, writing, truncate, append );
 		}
 		break;
 
@@ -60,12 +760,21 @@ Value BuiltInNode_Struct_OS_Open( Interpreter *interpreter, Value &self, Node *a
 
 	std::filesystem::create_directories( std::filesystem::path( filename ).parent_path().string() );
 
-	std::fstream file( filename, mode );
+	// whatever the variable still had open is written out and closed first
+	if ( reopen )
+		interpreter->fileTable.close( reopen->fileId );
 
-	if ( !file.is_open() )
+	i32 fd = fd_open( filename, flags );
+	if ( fd < 0 )
 		return nullptr;
 
-	return { filename, file };
+	if ( reopen )
+	{
+		reopen->fileId = interpreter->fileTable.open( filename, fd );
+		return *reopen;
+	}
+
+	return file_value( filename, interpreter->fileTable.open( filename, fd ) );
 }
 
 Value BuiltInNode_Struct_OS_Close( Interpreter *interpreter, Value &self, Node *args )
@@ -76,9 +785,9 @@ Value BuiltInNode_Struct_OS_Close( Interpreter *interpreter, Value &self, Node *
 	Value &value = interpreter->run( arg ).deref();
 	if ( value.type != ValueType::File )
 		interpreter->fatal( RESULT_CODE_VALUE_NOT_A_FILE, args, "close called on a value that is not a file." );
-	value.file->close();
-	value.file = nullptr;
-	return true;
+	bool closed = interpreter->fileTable.close( value.fileId );
+	value.fileId = 0;
+	return closed;
 }
 
 Value BuiltInNode_Struct_OS_Exists( Interpreter *interpreter, Value &self, Node *args )
@@ -100,54 +809,223 @@ Value BuiltInNode_Struct_OS_FileSize( Interpreter *interpreter, Value &self, Nod
 	Value &value = interpreter->run( arg ).deref();
 	if ( value.type == ValueType::File )
 	{
-		std::streampos current = value.file->tellg();
-		value.file->seekg( 0, std::ios::end );
-		std::streampos filesize = value.file->tellg();
-		value.file->seekg( current, std::ios::beg );
-		return static_cast<i64>( filesize );
+		return expect_file( interpreter, args, value, "file_size" ).size();
 	}
 	return static_cast<i64>( std::filesystem::file_size( value.get_as_string( interpreter, arg ) ) );
 }
 
+// read( file ) for the rest of the file, or read( file, bytes ) for up to that
+// many. Undefined once the file has nothing left.
 Value BuiltInNode_Struct_OS_Read( Interpreter *interpreter, Value &self, Node *args )
 {
 	(void)self;
-	interpreter->expect_arg( "read", args, 1 );
+	if ( args->children.size() != 1 && args->children.size() != 2 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "read received incorrect arguments." );
+
 	Arg arg = &args->children[ 0 ];
-	Value &value = interpreter->run( arg ).deref();
-	if ( value.type != ValueType::File )
-		interpreter->fatal( RESULT_CODE_VALUE_NOT_A_FILE, args, "read called on a value that is not a file." );
-	// TODO : 
-	// what should read be done in
-	// bytes
-	// lines
-	// custom delim?
-	return 0;
+	Value fileValue = interpreter->run( arg.next() );
+	FileHandle &handle = expect_file( interpreter, args, fileValue.deref(), "read" );
+
+	std::string data;
+	if ( args->children.size() == 1 )
+	{
+		handle.read_rest( data );
+		return data;
+	}
+
+	i64 size = interpreter->run( arg ).get_as_i64( interpreter, arg );
+	if ( size < 0 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, arg, "read of {} bytes.", size );
+	if ( !handle.read( static_cast<u64>( size ), data ) )
+		return nullptr;
+	return data;
+}
+
+// The next line without its line break, Undefined once the file has nothing left
+Value BuiltInNode_Struct_OS_ReadLine( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "read_line", args, 1 );
+	Arg arg = &args->children[ 0 ];
+	Value fileValue = interpreter->run( arg );
+	FileHandle &handle = expect_file( interpreter, args, fileValue.deref(), "read_line" );
+
+	std::string line;
+	if ( !handle.read_line( line ) )
+		return nullptr;
+	return line;
+}
+
+// read_until( file, delim ), the bytes before the next one character delim
+Value BuiltInNode_Struct_OS_ReadUntil( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "read_until", args, 2 );
+	Arg arg = &args->children[ 0 ];
+	Value fileValue = interpreter->run( arg.next() );
+	FileHandle &handle = expect_file( interpreter, args, fileValue.deref(), "read_until" );
+
+	std::string delim = interpreter->run( arg ).get_as_string( interpreter, arg );
+	if ( delim.size() != 1 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, arg, "read_until takes a one character delimiter, got \"{}\".", delim );
+
+	std::string data;
+	if ( !handle.read_until( delim[ 0 ], data ) )
+		return nullptr;
+	return data;
 }
 
+Value BuiltInNode_Struct_OS_Eof( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "eof", args, 1 );
+	Arg arg = &args->children[ 0 ];
+	Value fileValue = interpreter->run( arg );
+	return expect_file( interpreter, args, fileValue.deref(), "eof" ).at_end();
+}
+
+// lines( path ), the file opened for reading, to loop over by line. A loop
+// over it closes it when it ends.
+Value BuiltInNode_Struct_OS_Lines( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "lines", args, 1 );
+	Arg arg = &args->children[ 0 ];
+	std::string path = interpreter->run( arg ).get_as_string( interpreter, arg );
+
+	i32 fd = fd_open( path, open_flags( true, false, false, false ) );
+	if ( fd < 0 )
+		return nullptr;
+
+	FileId fileId = interpreter->fileTable.open( path, fd );
+	interpreter->fileTable.get( fileId )->closeAtEnd = true;
+	return file_value( path, fileId );
+}
+
+// stdin_lines(), the process's stdin as a file to loop over or read from
+Value BuiltInNode_Struct_OS_StdinLines( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "stdin_lines", args, 0 );
+
+	return file_value( "stdin", interpreter->fileTable.standard_input() );
+}
+
+// The file read into a buffer sized from its length, with one large read.
+// Always a string, os.map gives a view of the file instead.
 Value BuiltInNode_Struct_OS_ReadFile( Interpreter *interpreter, Value &self, Node *args )
 {
 	(void)self;
 	interpreter->expect_arg( "read_file", args, 1 );
 	Arg arg = &args->children[ 0 ];
-	std::fstream file( interpreter->run( arg ).get_as_string( interpreter, arg ), std::ios_base::in | std::ios_base::binary );
-	if ( !file.is_open() )
+	std::string path = interpreter->run( arg ).get_as_string( interpreter, arg );
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::error_code error;
+	u64 size = std::filesystem::file_size( path, error );
+	if ( error )
+		return nullptr;
+
+	i32 fd = fd_open( path, open_flags( true, false, false, false ) );
+	if ( fd < 0 )
 		return nullptr;
-	std::string ret = std::string( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
-	file.close();
+
+	// one more byte than measured, to see if the file grew since
+	std::string data;
+	data.resize( size + 1 );
+	u64 got = 0;
+	for ( i64 chunk; ( chunk = fd_read( fd, data.data() + got, data.size() - got ) ) > 0; )
+	{
+		got += static_cast<u64>( chunk );
+		if ( got == data.size() )
+			data.resize( data.size() * 2 );
+	}
+	fd_close( fd );
+	data.resize( got );
+
+	Value ret = std::move( data );
+
+	std::chrono::duration<f64, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	interpreter->io.readFileCalls += 1;
+	interpreter->io.readFileBytes += ret.count();
+	interpreter->io.readFileMs += elapsed.count();
+
 	return ret;
 }
 
+// write( file, value ), the bytes written or -1 when the file couldn't be written
 Value BuiltInNode_Struct_OS_Write( Interpreter *interpreter, Value &self, Node *args )
 {
 	(void)self;
 	interpreter->expect_arg( "write", args, 2 );
 	Arg arg = &args->children[ 0 ];
 	Value &value = interpreter->run( arg.next() ).deref();
-	if ( value.type != ValueType::File )
-		interpreter->fatal( RESULT_CODE_VALUE_NOT_A_FILE, args, "write called on a value that is not a file." );
-	std::string data = interpreter->run( arg ).get_as_string( interpreter, arg );
-	i64 size = static_cast<i64>( data.size() );
-	value.file->write( data.data(), data.size() );
-	return size;
-}
\ No newline at end of file
+	FileHandle &handle = expect_file( interpreter, args, value, "write" );
+	Value data = interpreter->run( arg );
+	return write_value( interpreter, arg, handle, data.deref() );
+}
+
+// flush( file ), false when the file couldn't be written
+Value BuiltInNode_Struct_OS_Flush( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "flush", args, 1 );
+	Arg arg = &args->children[ 0 ];
+	Value fileValue = interpreter->run( arg );
+	return static_cast<i32>( expect_file( interpreter, args, fileValue.deref(), "flush" ).flush() );
+}
+
+// map( path ), the file as read-only Bytes without reading it in
+Value BuiltInNode_Struct_OS_Map( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "map", args, 1 );
+	Arg arg = &args->children[ 0 ];
+	std::string path = interpreter->run( arg ).get_as_string( interpreter, arg );
+
+	std::shared_ptr<MappedFile> mapped = map_file( path );
+	if ( !mapped )
+		return nullptr;
+
+	std::string_view bytes( mapped->data, mapped->size );
+	return bytes_value( std::move( mapped ), bytes );
+}
+
+static const ByteView &bytes_of( Value &self )
+{
+	return static_cast<const ByteView &>( *self.deref().collection );
+}
+
+Value BuiltInNode_Bytes_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "count", args, 0 );
+	return static_cast<i64>( bytes_of( self ).count() );
+}
+
+// A copy of the bytes as a string
+Value BuiltInNode_Bytes_Str( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "str", args, 0 );
+	return bytes_of( self ).to_string();
+}
+
+// slice( from ) or slice( from, to ), a view of the same mapping
+Value BuiltInNode_Bytes_Slice( Interpreter *interpreter, Value &self, Node *args )
+{
+	if ( args->children.empty() || args->children.size() > 2 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "slice received incorrect arguments." );
+
+	const ByteView &view = bytes_of( self );
+	i64 size = static_cast<i64>( view.count() );
+
+	i64 from = interpreter->run( args->children[ 0 ] ).get_as_i64( interpreter, args->children[ 0 ] );
+	i64 to = size;
+	if ( args->children.size() == 2 )
+		to = interpreter->run( args->children[ 1 ] ).get_as_i64( interpreter, args->children[ 1 ] );
+
+	if ( from < 0 || from > to || to > size )
+		interpreter->fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, args, "slice( {}, {} ) is outside the {} bytes.", from, to, size );
+
+	return bytes_value( view.mapping, view.bytes.substr( static_cast<u64>( from ), static_cast<u64>( to - from ) ) );
+}
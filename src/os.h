@@ -1,6 +1,113 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "value.h"
+#include "collections.h"
+
+// Bytes a file handle asks the descriptor for at once, and when a loop reads it by line
+constexpr u64 FileBufferSize = 1 << 16;
+constexpr u64 LineBufferSize = 1 << 20;
+// Bytes written to a file handle that are gathered before the descriptor gets them
+constexpr u64 WriteBufferSize = 1 << 16;
+
+// An open descriptor and the bytes read ahead of the script. Reads by size,
+// line or delimiter are served from the buffer, which is refilled by one large
+// read, so memory stays bounded however large the file is. Small writes are
+// gathered the same way and go to the descriptor together.
+struct FileHandle
+{
+	i32 fd = -1;
+	std::string path;
+	std::vector<char> buffer;
+	// unread bytes are buffer[ start, end )
+	u64 start = 0;
+	u64 end = 0;
+	// written bytes the descriptor hasn't been given yet
+	std::string output;
+	bool writing = false;
+	// the process's stdin, which is never seeked or closed
+	bool standardInput = false;
+	// opened by os.lines, closed once a loop over it ends
+	bool closeAtEnd = false;
+
+	bool is_open() const { return fd >= 0; }
+	bool read( u64 size, std::string &out );
+	bool read_until( char delim, std::string &out );
+	bool read_line( std::string &out );
+	void read_rest( std::string &out );
+	bool at_end();
+	void unread();
+	bool write( const char *data, u64 size );
+	bool write_parts( const std::vector<std::string_view> &parts );
+	bool flush();
+	i64 size();
+	void close();
+
+	FileHandle();
+	~FileHandle();
+
+private:
+	bool fill();
+	bool write_output();
+};
+
+// Ids a File value holds. The slot is in the low half and the generation it
+// was opened in is in the high half, so an id kept after its file is closed
+// doesn't find whatever was opened in the slot next. Zero is no file.
+using FileId = u64;
+
+// Files the interpreter has open. Slots of closed files are reused along with
+// their buffers.
+struct FileTable
+{
+	struct Slot
+	{
+		std::unique_ptr<FileHandle> handle;
+		u32 generation = 0;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<u32> freeSlots;
+	FileId stdinId = 0;
+
+	FileId open( const std::string &path, i32 fd, bool standardInput = false );
+	FileId standard_input();
+	FileHandle *get( FileId id ) const;
+	bool close( FileId id );
+	void cleanup();
+};
+
+// A whole file mapped read-only, unmapped when the last view of it goes away
+struct MappedFile
+{
+	const char *data = nullptr;
+	u64 size = 0;
+
+	~MappedFile();
+};
+
+std::shared_ptr<MappedFile> map_file( const std::string &path );
+
+// Read-only bytes of a mapped file. It stands in for a string, and is only
+// copied out when something needs a std::string.
+struct ByteView : Collection
+{
+	std::shared_ptr<MappedFile> mapping;
+	std::string_view bytes;
+
+	u64 count() const override { return bytes.size(); }
+	std::string to_string() const override { return std::string( bytes ); }
+
+	bool next_line( u64 &at, std::string_view &line ) const;
+};
+
+Value bytes_value( std::shared_ptr<MappedFile> mapping, std::string_view bytes );
+
 Value BuiltInNode_Struct_OS_MkDir( Interpreter *interpreter, Value &self, Node *args );
 Value BuiltInNode_Struct_OS_Rm( Interpreter *interpreter, Value &self, Node *args );
 Value BuiltInNode_Struct_OS_Open( Interpreter *interpreter, Value &self, Node *args );
@@ -8,5 +115,15 @@ Value BuiltInNode_Struct_OS_Close( Interpreter *interpreter, Value &self, Node *
 Value BuiltInNode_Struct_OS_Exists( Interpreter *interpreter, Value &self, Node *args );
 Value BuiltInNode_Struct_OS_FileSize( Interpreter *interpreter, Value &self, Node *args );
 Value BuiltInNode_Struct_OS_Read( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_ReadLine( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_ReadUntil( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_Eof( Interpreter *interpreter, Value &self, Node *args );
 Value BuiltInNode_Struct_OS_ReadFile( Interpreter *interpreter, Value &self, Node *args );
-Value BuiltInNode_Struct_OS_Write( Interpreter *interpreter, Value &self, Node *args );
\ No newline at end of file
+Value BuiltInNode_Struct_OS_Map( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_Lines( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_StdinLines( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_Write( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_OS_Flush( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Bytes_Count( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Bytes_Str( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Bytes_Slice( Interpreter *interpreter, Value &self, Node *args );
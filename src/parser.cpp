@@ -671,6 +671,7 @@ static Node *parser_parse_stringliteral( Parser *parser )
 {
 	Token *token = parser_consume( parser, TokenID::StringLiteral );
 	Node *node = new_node( parser, NodeID::StringLiteral, token );
+	node->name = intern( node->value.valueString );
 	return node;
 }
 
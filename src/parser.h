@@ -16,124 +16,15 @@ struct NodeType
 
 constexpr NodeType NodeTypes[] =
 {
-	{
-		.id = NodeID::Entry,
-		.name = "Entry",
-	},
-	{
-		.id = NodeID::Block,
-		.name = "Block",
-	},
-	{
-		.id = NodeID::Identifier,
-		.name = "Identifier",
-	},
-	{
-		.id = NodeID::CreateIdentifier,
-		.name = "CreateIdentifier",
-	},
-	{
-		.id = NodeID::StringLiteral,
-		.name = "StringLiteral",
-	},
-	{
-		.id = NodeID::Number,
-		.name = "Number",
-	},
-	{
-		.id = NodeID::CreateStruct,
-		.name = "CreateStruct",
-	},
-	{
-		.id = NodeID::CreateArray,
-		.name = "CreateArray",
-	},
-	{
-		.id = NodeID::ArrayAccess,
-		.name = "ArrayAccess",
-	},
-	{
-		.id = NodeID::Assignment,
-		.name = "Assignment",
-	},
-	{
-		.id = NodeID::Operation,
-		.name = "Operation",
-	},
-	{
-		.id = NodeID::AssignmentOp,
-		.name = "AssignmentOp",
-	},
-	{
-		.id = NodeID::DeclFunc,
-		.name = "DeclFunc",
-	},
-	{
-		.id = NodeID::FunctionArgs,
-		.name = "FunctionArgs",
-	},
-	{
-		.id = NodeID::FunctionCall,
-		.name = "FunctionCall",
-	},
-	{
-		.id = NodeID::If,
-		.name = "If",
-	},
-	{
-		.id = NodeID::Import,
-		.name = "Import",
-	},
-	{
-		.id = NodeID::Return,
-		.name = "Return",
-	},
-	{
-		.id = NodeID::Print,
-		.name = "Print",
-	},
-	{
-		.id = NodeID::Println,
-		.name = "Println",
-	},
-	{
-		.id = NodeID::Assert,
-		.name = "Assert",
-	},
-	{
-		.id = NodeID::ForNumberRange,
-		.name = "ForNumberRange",
-	},
-	{
-		.id = NodeID::ForOfIdentifier,
-		.name = "ForOfIdentifier",
-	},
-	{
-		.id = NodeID::ForOfIdentifierRange,
-		.name = "ForOfIdentifierRange",
-	},
-	{
-		.id = NodeID::ForOfIdentifierRangeCount,
-		.name = "ForOfIdentifierRangeCount",
-	},
-	{
-		.id = NodeID::While,
-		.name = "While",
-	},
-	{
-		.id = NodeID::Continue,
-		.name = "Continue",
-	},
-	{
-		.id = NodeID::Break,
-		.name = "Break",
-	},
-	{
-		.id = NodeID::Exit,
-		.name = "Exit",
-	},
+#define NODE_TYPE_ENTRY( nodeID ) { .id = NodeID::nodeID, .name = #nodeID },
+	NODE_IDS( NODE_TYPE_ENTRY )
+#undef NODE_TYPE_ENTRY
 };
 
+struct CallSite;
+struct JitRegion;
+struct VmChunk;
+
 struct Node
 {
 	NodeID type;
@@ -143,6 +34,22 @@ struct Node
 	Value value;
 	std::vector<Node*> children;
 	i32 scope;
+	// proven by the type pass, Undefined when unknown
+	ValueType staticType = ValueType::Undefined;
+
+	// -- interpreter caches, empty on a new or cloned node --
+	const InternedString *name = nullptr;
+	std::vector<Value*> *slot = nullptr;
+	// the data generation slot was found in
+	u32 slotGeneration = 0;
+	CallSite *callSite = nullptr;
+	// builtin method last found on a value of methodType by this dot segment
+	ValueType methodType = ValueType::Undefined;
+	Value *method = nullptr;
+	ShapeCache shapeCache = {};
+	JitRegion *jitRegion = nullptr;
+	// a function body compiled for the frame loop, see vm.cpp
+	VmChunk *chunk = nullptr;
 };
 
 struct Parser
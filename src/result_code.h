@@ -31,6 +31,10 @@ enum RESULT_CODE
 	RESULT_CODE_INVALID_IMPORT,
 	RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC,
 	RESULT_CODE_ASSERT_FAILED,
+	RESULT_CODE_CALL_DEPTH_EXCEEDED,
+	RESULT_CODE_INVALID_OPTION,
+	RESULT_CODE_JIT_MISMATCH,
+	RESULT_CODE_FAILED_TO_OPEN_OUTPUT_FILE,
 };
 
 // --------------------------------------------------------------------
@@ -76,6 +80,10 @@ struct std::formatter<RESULT_CODE>
 		case RESULT_CODE_INVALID_IMPORT: name = "RESULT_CODE_INVALID_IMPORT"; break;
 		case RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC: name = "RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC"; break;
 		case RESULT_CODE_ASSERT_FAILED: name = "RESULT_CODE_ASSERT_FAILED"; break;
+		case RESULT_CODE_CALL_DEPTH_EXCEEDED: name = "RESULT_CODE_CALL_DEPTH_EXCEEDED"; break;
+		case RESULT_CODE_INVALID_OPTION: name = "RESULT_CODE_INVALID_OPTION"; break;
+		case RESULT_CODE_JIT_MISMATCH: name = "RESULT_CODE_JIT_MISMATCH"; break;
+		case RESULT_CODE_FAILED_TO_OPEN_OUTPUT_FILE: name = "RESULT_CODE_FAILED_TO_OPEN_OUTPUT_FILE"; break;
 		}
 
 		return std::format_to( ctx.out(), "{}", name );
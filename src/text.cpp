@@ -0,0 +1,429 @@
+
+#include <bit>
+#include <charconv>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define TEXT_SSE2 1
+#else
+#define TEXT_SSE2 0
+#endif
+
+#include "text.h"
+#include "interpreter.h"
+#include "os.h"
+
+// -- strbuf --
+
+void StrBuf::append( const char *data, u64 size )
+{
+	if ( !size )
+		return;
+
+	if ( chunks.empty() || chunks.back().capacity() - chunks.back().size() < size )
+	{
+		std::string &chunk = chunks.emplace_back();
+		chunk.reserve( std::max( size, std::max( length, StrBufMinChunk ) ) );
+	}
+
+	chunks.back().append( data, size );
+	length += size;
+}
+
+void StrBuf::append( const Value &value )
+{
+	const Value &v = value.deref();
+
+	switch ( v.type )
+	{
+	case ValueType::StringLiteral:
+		append( v.valueString.data(), v.valueString.size() );
+		return;
+
+	case ValueType::Bytes:
+		{
+			std::string_view bytes = text_view( v );
+			append( bytes.data(), bytes.size() );
+		}
+		return;
+
+	case ValueType::NumberI32:
+	case ValueType::NumberI64:
+		{
+			char digits[ 24 ];
+			auto result = std::to_chars( digits, digits + sizeof( digits ), v.type == ValueType::NumberI32 ? v.valueI32 : v.valueI64 );
+			append( digits, static_cast<u64>( result.ptr - digits ) );
+		}
+		return;
+
+	case ValueType::StrBuf:
+		if ( v.collection == this )
+		{
+			std::string text = str();
+			append( text.data(), text.size() );
+		}
+		else
+		{
+			const std::string &text = static_cast<const StrBuf &>( *v.collection ).str();
+			append( text.data(), text.size() );
+		}
+		return;
+	}
+
+	std::string text = std::format( "{}", v );
+	append( text.data(), text.size() );
+}
+
+const std::string &StrBuf::str() const
+{
+	static const std::string empty;
+
+	if ( chunks.empty() )
+		return empty;
+
+	if ( chunks.size() > 1 )
+	{
+		std::string flat;
+		flat.reserve( length );
+		for ( const std::string &chunk : chunks )
+			flat += chunk;
+
+		chunks.clear();
+		chunks.push_back( std::move( flat ) );
+	}
+
+	return chunks[ 0 ];
+}
+
+void StrBuf::clear()
+{
+	chunks.clear();
+	length = 0;
+}
+
+// -- search kernels --
+
+constexpr u64 TextNotFound = ~0ull;
+
+// First position of needle in text at or after from. Candidates are found 16
+// starts at a time by matching the needle's first and last byte, only those
+// are compared in full.
+static u64 text_find( std::string_view text, std::string_view needle, u64 from = 0 )
+{
+	u64 length = needle.size();
+	if ( from > text.size() || length > text.size() - from )
+		return TextNotFound;
+	if ( length == 0 )
+		return from;
+
+	const char *data = text.data();
+
+	if ( length == 1 )
+	{
+		const void *at = std::memchr( data + from, needle[ 0 ], text.size() - from );
+		return at ? static_cast<u64>( static_cast<const char *>( at ) - data ) : TextNotFound;
+	}
+
+	u64 last = text.size() - length;
+	u64 i = from;
+
+#if TEXT_SSE2
+	__m128i firstByte = _mm_set1_epi8( needle[ 0 ] );
+	__m128i lastByte = _mm_set1_epi8( needle[ length - 1 ] );
+
+	for ( ; i + 16 <= last + 1; i += 16 )
+	{
+		__m128i starts = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i ) );
+		__m128i ends = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i + length - 1 ) );
+		u32 bits = static_cast<u32>( _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( starts, firstByte ), _mm_cmpeq_epi8( ends, lastByte ) ) ) );
+
+		for ( ; bits; bits &= bits - 1 )
+		{
+			u64 at = i + std::countr_zero( bits );
+			if ( std::memcmp( data + at + 1, needle.data() + 1, length - 2 ) == 0 )
+				return at;
+		}
+	}
+#endif
+
+	for ( ; i <= last; ++i )
+	{
+		if ( data[ i ] == needle[ 0 ] && data[ i + length - 1 ] == needle[ length - 1 ] && std::memcmp( data + i + 1, needle.data() + 1, length - 2 ) == 0 )
+			return i;
+	}
+
+	return TextNotFound;
+}
+
+static bool is_space( char c )
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void append_text( std::string &out, const Value &value )
+{
+	const Value &v = value.deref();
+
+	switch ( v.type )
+	{
+	case ValueType::StringLiteral:
+		out += v.valueString;
+		return;
+
+	case ValueType::Bytes:
+		out += text_view( v );
+		return;
+
+	case ValueType::NumberI32:
+	case ValueType::NumberI64:
+		{
+			char digits[ 24 ];
+			auto result = std::to_chars( digits, digits + sizeof( digits ), v.type == ValueType::NumberI32 ? v.valueI32 : v.valueI64 );
+			out.append( digits, result.ptr );
+		}
+		return;
+	}
+
+	std::format_to( std::back_inserter( out ), "{}", v );
+}
+
+// -- script interface --
+
+static StrBuf &strbuf_of( Value &self )
+{
+	return static_cast<StrBuf &>( *self.deref().collection );
+}
+
+// strbuf() or strbuf( text ) to start from
+Value BuiltInNode_Struct_Strings_StrBuf( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	if ( args->children.size() > 1 )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "strbuf received incorrect arguments." );
+
+	Value buf( ValueType::StrBuf );
+	if ( args->children.size() == 1 )
+		strbuf_of( buf ).append( interpreter->run( args->children[ 0 ] ) );
+	return buf;
+}
+
+Value BuiltInNode_StrBuf_Append( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "append", args, 1 );
+	strbuf_of( self ).append( interpreter->run( args->children[ 0 ] ) );
+	return 0;
+}
+
+Value BuiltInNode_StrBuf_Str( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "str", args, 0 );
+	return strbuf_of( self ).str();
+}
+
+Value BuiltInNode_StrBuf_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "count", args, 0 );
+	return static_cast<i64>( strbuf_of( self ).count() );
+}
+
+Value BuiltInNode_StrBuf_Clear( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "clear", args, 0 );
+	strbuf_of( self ).clear();
+	return 0;
+}
+
+// A string argument. A variable comes back as a reference, so its text is read in place.
+static Value text_arg( Interpreter *interpreter, Node *arg )
+{
+	Value value = interpreter->run( arg );
+	ValueType type = value.deref().type;
+	if ( type == ValueType::StringLiteral || type == ValueType::Bytes )
+		return value;
+	return value.deref().get_as_string( interpreter, arg );
+}
+
+// Byte views are searched in place
+static std::string_view text_of( const Value &value )
+{
+	return text_view( value.deref() );
+}
+
+// A part of text's view, a byte view gives a slice sharing its mapping and
+// anything else gives a copy
+static Value text_piece( const Value &text, std::string_view piece )
+{
+	const Value &v = text.deref();
+	if ( v.type == ValueType::Bytes )
+		return bytes_value( static_cast<const ByteView &>( *v.collection ).mapping, piece );
+	return std::string( piece );
+}
+
+static Value needle_arg( Interpreter *interpreter, Node *arg, const char *name )
+{
+	Value needle = text_arg( interpreter, arg );
+	if ( text_of( needle ).empty() )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, arg, "{} needs a non-empty string to look for.", name );
+	return needle;
+}
+
+// find( text, needle ), the position of the first match or -1
+Value BuiltInNode_Struct_Strings_Find( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "find", args, 2 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	Value needle = text_arg( interpreter, args->children[ 1 ] );
+
+	u64 at = text_find( text_of( text ), text_of( needle ) );
+	return at == TextNotFound ? static_cast<i64>( -1 ) : static_cast<i64>( at );
+}
+
+// count( text, needle ), matches that don't overlap
+Value BuiltInNode_Struct_Strings_Count( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "count", args, 2 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	Value needle = needle_arg( interpreter, args->children[ 1 ], "count" );
+	std::string_view haystack = text_of( text );
+	std::string_view pattern = text_of( needle );
+
+	i64 count = 0;
+	for ( u64 at = text_find( haystack, pattern ); at != TextNotFound; at = text_find( haystack, pattern, at + pattern.size() ) )
+		count += 1;
+	return count;
+}
+
+// split( text, separator ), every piece including empty ones, pieces of a
+// byte view are slices of it
+Value BuiltInNode_Struct_Strings_Split( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "split", args, 2 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	Value separator = needle_arg( interpreter, args->children[ 1 ], "split" );
+	std::string_view haystack = text_of( text );
+	std::string_view pattern = text_of( separator );
+
+	Value pieces( ValueType::Arr );
+	pieces.unpack();
+
+	u64 start = 0;
+	for ( u64 at = text_find( haystack, pattern ); at != TextNotFound; at = text_find( haystack, pattern, start ) )
+	{
+		pieces.array->values.push_back( text_piece( text, haystack.substr( start, at - start ) ) );
+		start = at + pattern.size();
+	}
+	pieces.array->values.push_back( text_piece( text, haystack.substr( start ) ) );
+
+	return pieces;
+}
+
+// replace( text, from, to ), every match that doesn't overlap
+Value BuiltInNode_Struct_Strings_Replace( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "replace", args, 3 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	Value from = needle_arg( interpreter, args->children[ 1 ], "replace" );
+	Value to = text_arg( interpreter, args->children[ 2 ] );
+	std::string_view haystack = text_of( text );
+	std::string_view pattern = text_of( from );
+
+	u64 at = text_find( haystack, pattern );
+	if ( at == TextNotFound )
+		return text.deref();
+
+	std::string out;
+	out.reserve( haystack.size() );
+
+	u64 start = 0;
+	for ( ; at != TextNotFound; at = text_find( haystack, pattern, start ) )
+	{
+		out.append( haystack.substr( start, at - start ) );
+		out.append( text_of( to ) );
+		start = at + pattern.size();
+	}
+	out.append( haystack.substr( start ) );
+
+	return out;
+}
+
+Value BuiltInNode_Struct_Strings_StartsWith( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "starts_with", args, 2 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	Value prefix = text_arg( interpreter, args->children[ 1 ] );
+
+	return static_cast<i32>( text_of( text ).starts_with( text_of( prefix ) ) );
+}
+
+// trim( text ), without spaces, tabs or line breaks at either end
+Value BuiltInNode_Struct_Strings_Trim( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "trim", args, 1 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	std::string_view view = text_of( text );
+
+	u64 start = 0;
+	u64 end = view.size();
+	while ( start < end && is_space( view[ start ] ) )
+		start += 1;
+	while ( end > start && is_space( view[ end - 1 ] ) )
+		end -= 1;
+
+	return text_piece( text, view.substr( start, end - start ) );
+}
+
+Value BuiltInNode_Struct_Strings_ToUpper( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "to_upper", args, 1 );
+
+	Value text = text_arg( interpreter, args->children[ 0 ] );
+	std::string out( text_of( text ) );
+
+	// without a branch per byte, so the loop vectorises
+	for ( char &c : out )
+		c = static_cast<char>( c - ( static_cast<u8>( c - 'a' ) < 26 ? 32 : 0 ) );
+
+	return out;
+}
+
+// join( array, separator )
+Value BuiltInNode_Struct_Strings_Join( Interpreter *interpreter, Value &self, Node *args )
+{
+	(void)self;
+	interpreter->expect_arg( "join", args, 2 );
+
+	Value entries = interpreter->run( args->children[ 0 ] );
+	const Value &arr = entries.deref();
+	if ( arr.type != ValueType::Arr )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args->children[ 0 ], "join expects an array, got {}.", arr.type );
+
+	Value separator = text_arg( interpreter, args->children[ 1 ] );
+
+	std::string out;
+	for ( u64 i = 0, count = arr.array_count(); i < count; ++i )
+	{
+		if ( i )
+			out.append( text_of( separator ) );
+
+		if ( arr.array->packed )
+			append_text( out, arr.array->ints[ i ] );
+		else
+			append_text( out, arr.array->values[ i ] );
+	}
+
+	return out;
+}
@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "collections.h"
+
+// Chunk a StrBuf starts with, later chunks are as large as everything before them
+constexpr u64 StrBufMinChunk = 256;
+
+// String builder. Appends go into chunks that are never reallocated, so a
+// long build copies each byte once when it lands and once more when the text
+// is flattened, which only happens when it's read.
+struct StrBuf : Collection
+{
+	// flattening replaces the chunks with one, the text doesn't change
+	mutable std::vector<std::string> chunks;
+	u64 length = 0;
+
+	u64 count() const override { return length; }
+	std::string to_string() const override { return str(); }
+
+	void append( const char *data, u64 size );
+	void append( const Value &value );
+	const std::string &str() const;
+	void clear();
+};
+
+Value BuiltInNode_Struct_Strings_StrBuf( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Find( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Count( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Split( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Replace( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_StartsWith( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Trim( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_ToUpper( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_Struct_Strings_Join( Interpreter *interpreter, Value &self, Node *args );
+
+Value BuiltInNode_StrBuf_Append( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_StrBuf_Str( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_StrBuf_Count( Interpreter *interpreter, Value &self, Node *args );
+Value BuiltInNode_StrBuf_Clear( Interpreter *interpreter, Value &self, Node *args );
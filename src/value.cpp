@@ -1,9 +1,13 @@
 
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
 #include "value.h"
 #include "interpreter.h"
+#include "collections.h"
+#include "text.h"
+#include "os.h"
 
 [[noreturn]] static void value_fatal( RESULT_CODE resultCode, const char *message )
 {
@@ -47,7 +51,7 @@ static Value BuiltInNode_Array_Push( Interpreter *interpreter, Value &self, Node
 {
 	Value &l = self.deref();
 	for ( auto arg : args->children )
-		l.arr.push_back( interpreter->run( arg ) );
+		l.array_push( interpreter->run( arg ) );
 	return 0;
 }
 
@@ -55,43 +59,741 @@ static Value BuiltInNode_Array_Pop( Interpreter *interpreter, Value &self, Node
 {
 	interpreter->expect_arg( "pop", args, 1 );
 	Value &l = self.deref();
-	Value ret = l.arr.back();
-	l.arr.pop_back();
+
+	if ( l.array->packed )
+	{
+		i64 ret = l.array->ints.back();
+		l.array->ints.pop_back();
+		return ret;
+	}
+
+	Value ret = l.array->values.back();
+	l.array->values.pop_back();
 	return ret;
 }
 
 static Value BuiltInNode_Array_Count( Interpreter *interpreter, Value &self, Node *args )
 {
 	interpreter->expect_arg( "count", args, 0 );
-	return static_cast<i64>( self.deref().arr.size() );
+	return static_cast<i64>( self.deref().array_count() );
+}
+
+static Value entry_of( const Value &arr, u64 index )
+{
+	return arr.array->packed ? Value( arr.array->ints[ index ] ) : arr.array->values[ index ];
+}
+
+// -- sorting --
+
+// LSD radix sort over the bytes of the keys, with the sign bit flipped so
+// negative keys come first. A byte every key shares is skipped. Stable.
+template <typename T, typename Key>
+static void radix_sort( T *data, u64 count, Key key )
+{
+	if ( count < 2 )
+		return;
+
+	std::vector<u64> counts( 8 * 256, 0 );
+	for ( u64 i = 0; i < count; ++i )
+	{
+		u64 bits = static_cast<u64>( key( data[ i ] ) ) ^ ( 1ull << 63 );
+		for ( u32 byte = 0; byte < 8; ++byte )
+			counts[ byte * 256 + ( ( bits >> ( byte * 8 ) ) & 255 ) ] += 1;
+	}
+
+	std::vector<T> buffer( count );
+	T *src = data;
+	T *dst = buffer.data();
+	u64 first = static_cast<u64>( key( data[ 0 ] ) ) ^ ( 1ull << 63 );
+
+	for ( u32 byte = 0; byte < 8; ++byte )
+	{
+		u64 *bucket = &counts[ byte * 256 ];
+		if ( bucket[ ( first >> ( byte * 8 ) ) & 255 ] == count )
+			continue;
+
+		u64 offset = 0;
+		for ( u32 digit = 0; digit < 256; ++digit )
+		{
+			u64 size = bucket[ digit ];
+			bucket[ digit ] = offset;
+			offset += size;
+		}
+
+		for ( u64 i = 0; i < count; ++i )
+		{
+			u64 bits = static_cast<u64>( key( src[ i ] ) ) ^ ( 1ull << 63 );
+			dst[ bucket[ ( bits >> ( byte * 8 ) ) & 255 ]++ ] = std::move( src[ i ] );
+		}
+
+		std::swap( src, dst );
+	}
+
+	if ( src != data )
+		std::move( src, src + count, data );
+}
+
+// Sorts chunks on separate threads, then merges neighbouring runs, also on
+// separate threads, until one run is left
+template <typename T, typename Sort, typename Less>
+static void parallel_sort( std::vector<T> &data, Sort sort, Less less )
+{
+	u64 count = data.size();
+	u64 chunks = std::min<u64>( std::max( std::thread::hardware_concurrency(), 1u ), count / ParallelSortMin );
+
+	if ( chunks < 2 )
+	{
+		sort( data.data(), count );
+		return;
+	}
+
+	std::vector<u64> bounds;
+	for ( u64 i = 0; i <= chunks; ++i )
+		bounds.push_back( count * i / chunks );
+
+	{
+		std::vector<std::thread> threads;
+		for ( u64 i = 0; i < chunks; ++i )
+			threads.emplace_back( [&, i]() { sort( data.data() + bounds[ i ], bounds[ i + 1 ] - bounds[ i ] ); } );
+		for ( std::thread &thread : threads )
+			thread.join();
+	}
+
+	while ( bounds.size() > 2 )
+	{
+		std::vector<u64> merged = { 0 };
+		std::vector<std::thread> threads;
+
+		for ( u64 i = 0; i + 2 < bounds.size(); i += 2 )
+		{
+			threads.emplace_back( [&, i]() { std::inplace_merge( data.begin() + bounds[ i ], data.begin() + bounds[ i + 1 ], data.begin() + bounds[ i + 2 ], less ); } );
+			merged.push_back( bounds[ i + 2 ] );
+		}
+		if ( merged.back() != bounds.back() )
+			merged.push_back( bounds.back() );
+
+		for ( std::thread &thread : threads )
+			thread.join();
+		bounds = std::move( merged );
+	}
+}
+
+static void sort_ints( i64 *data, u64 count )
+{
+	if ( count < RadixSortMin )
+		std::sort( data, data + count );
+	else
+		radix_sort( data, count, []( i64 value ) { return value; } );
+}
+
+static bool is_number( ValueType type )
+{
+	return type == ValueType::NumberI32 || type == ValueType::NumberI64;
+}
+
+// Only numbers go to worker threads. Comparing anything else can fail, and a
+// failure has to end the run from the interpreter's thread.
+template <typename Less>
+static void sort_values( std::vector<Value> &values, Less less )
+{
+	auto sort = [less]( Value *data, u64 count ) { std::sort( data, data + count, less ); };
+
+	if ( std::ranges::all_of( values, []( const Value &value ) { return is_number( value.type ); } ) )
+		parallel_sort( values, sort, less );
+	else
+		sort( values.data(), values.size() );
 }
 
 static Value BuiltInNode_Array_Sort( Interpreter *interpreter, Value &self, Node *args )
 {
 	Value &l = self.deref();
 
-	if ( args->children.empty() )
+	bool ascending = args->children.empty() || interpreter->run( args->children[ 0 ] ).get_as_bool( interpreter, args );
+
+	if ( l.array->packed )
+	{
+		parallel_sort( l.array->ints, sort_ints, std::less<i64>() );
+		if ( !ascending )
+			std::ranges::reverse( l.array->ints );
+	}
+	else if ( ascending )
+	{
+		sort_values( l.array->values, std::less<Value>() );
+	}
+	else
+	{
+		sort_values( l.array->values, std::greater<Value>() );
+	}
+
+	return 0;
+}
+
+// Orders by what fn gives for each entry. fn runs once per entry rather than
+// per comparison, the entries are then moved into the order of their keys.
+// Keys are all numbers, compared by value, or all text, compared by bytes.
+static Value BuiltInNode_Array_SortBy( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "sort_by", args, 1 );
+
+	Value fn = interpreter->run( args->children[ 0 ] );
+	Value &callee = fn.deref();
+	if ( callee.type != ValueType::Node || !callee.valueNode )
+		interpreter->fatal( RESULT_CODE_NOT_CALLABLE, args, "sort_by expects a function." );
+
+	Node *funcNode = callee.valueNode;
+	CallSite *callSite = interpreter->get_call_site( args, funcNode );
+	u64 count = self.deref().array_count();
+
+	std::vector<Value> keys;
+	keys.reserve( count );
+	bool numberKeys = true;
+	bool textKeys = true;
+
+	for ( u64 i = 0; i < count; ++i )
+	{
+		Value entry = entry_of( self.deref(), i );
+		keys.push_back( interpreter->invoke( args, funcNode, callSite, nullptr, &entry ) );
+		keys.back().unfold();
+
+		ValueType type = keys.back().type;
+		numberKeys &= is_number( type );
+		textKeys &= is_text( type );
+		if ( !numberKeys && !textKeys )
+			interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "sort_by keys must all be numbers or all be strings, got {} and {}.", keys[ 0 ].type, type );
+	}
+
+	Value &l = self.deref();
+	if ( l.array_count() != count )
+		interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "sort_by key function changed the array." );
+
+	std::vector<u64> order( count );
+
+	if ( numberKeys )
+	{
+		std::vector<std::pair<i64, u64>> pairs( count );
+		for ( u64 i = 0; i < count; ++i )
+			pairs[ i ] = { keys[ i ].type == ValueType::NumberI32 ? keys[ i ].valueI32 : keys[ i ].valueI64, i };
+		radix_sort( pairs.data(), count, []( const std::pair<i64, u64> &pair ) { return pair.first; } );
+		for ( u64 i = 0; i < count; ++i )
+			order[ i ] = pairs[ i ].second;
+	}
+	else
+	{
+		for ( u64 i = 0; i < count; ++i )
+			order[ i ] = i;
+		std::ranges::stable_sort( order, [&keys]( u64 lhs, u64 rhs ) { return text_view( keys[ lhs ] ) < text_view( keys[ rhs ] ); } );
+	}
+
+	if ( l.array->packed )
+	{
+		std::vector<i64> sorted( count );
+		for ( u64 i = 0; i < count; ++i )
+			sorted[ i ] = l.array->ints[ order[ i ] ];
+		l.array->ints = std::move( sorted );
+	}
+	else
+	{
+		std::vector<Value> sorted;
+		sorted.reserve( count );
+		for ( u64 i = 0; i < count; ++i )
+			sorted.push_back( std::move( l.array->values[ order[ i ] ] ) );
+		l.array->values = std::move( sorted );
+	}
+
+	return 0;
+}
+
+// -- array kernels --
+// Loops over the packed buffer with no calls and no branches on the entries,
+// so the compiler vectorises them
+
+static i64 kernel_sum( const i64 *data, u64 count )
+{
+	u64 total = 0;
+	for ( u64 i = 0; i < count; ++i )
+		total += static_cast<u64>( data[ i ] );
+	return static_cast<i64>( total );
+}
+
+static i64 kernel_min( const i64 *data, u64 count )
+{
+	i64 result = data[ 0 ];
+	for ( u64 i = 1; i < count; ++i )
+		result = data[ i ] < result ? data[ i ] : result;
+	return result;
+}
+
+static i64 kernel_max( const i64 *data, u64 count )
+{
+	i64 result = data[ 0 ];
+	for ( u64 i = 1; i < count; ++i )
+		result = data[ i ] > result ? data[ i ] : result;
+	return result;
+}
+
+// Compares a block at a time, only a block with a match is searched entry by entry
+static i64 kernel_index_of( const i64 *data, u64 count, i64 value )
+{
+	constexpr u64 Block = 8;
+
+	u64 i = 0;
+	for ( ; i + Block <= count; i += Block )
+	{
+		bool found = false;
+		for ( u64 j = 0; j < Block; ++j )
+			found |= ( data[ i + j ] == value );
+		if ( found )
+			break;
+	}
+
+	for ( ; i < count; ++i )
+	{
+		if ( data[ i ] == value )
+			return static_cast<i64>( i );
+	}
+
+	return -1;
+}
+
+static void kernel_elementwise( i64 *data, const i64 *rhs, u64 count, TokenID op )
+{
+	switch ( op )
+	{
+	case TokenID::Plus:		for ( u64 i = 0; i < count; ++i ) data[ i ] = static_cast<i64>( static_cast<u64>( data[ i ] ) + static_cast<u64>( rhs[ i ] ) ); break;
+	case TokenID::Asterisk:	for ( u64 i = 0; i < count; ++i ) data[ i ] = static_cast<i64>( static_cast<u64>( data[ i ] ) * static_cast<u64>( rhs[ i ] ) ); break;
+	case TokenID::Amp:		for ( u64 i = 0; i < count; ++i ) data[ i ] &= rhs[ i ]; break;
+	case TokenID::Pipe:		for ( u64 i = 0; i < count; ++i ) data[ i ] |= rhs[ i ]; break;
+	}
+}
+
+static void kernel_elementwise( i64 *data, i64 rhs, u64 count, TokenID op )
+{
+	switch ( op )
+	{
+	case TokenID::Plus:		for ( u64 i = 0; i < count; ++i ) data[ i ] = static_cast<i64>( static_cast<u64>( data[ i ] ) + static_cast<u64>( rhs ) ); break;
+	case TokenID::Asterisk:	for ( u64 i = 0; i < count; ++i ) data[ i ] = static_cast<i64>( static_cast<u64>( data[ i ] ) * static_cast<u64>( rhs ) ); break;
+	case TokenID::Amp:		for ( u64 i = 0; i < count; ++i ) data[ i ] &= rhs; break;
+	case TokenID::Pipe:		for ( u64 i = 0; i < count; ++i ) data[ i ] |= rhs; break;
+	}
+}
+
+static Value BuiltInNode_Array_Sum( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "sum", args, 0 );
+	Value &l = self.deref();
+
+	if ( l.array->packed )
+		return kernel_sum( l.array->ints.data(), l.array->ints.size() );
+
+	Value total = static_cast<i64>( 0 );
+	for ( const Value &entry : l.array->values )
+		total += entry;
+	return total;
+}
+
+static Value BuiltInNode_Array_Min( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "min", args, 0 );
+	Value &l = self.deref();
+
+	if ( l.array_count() == 0 )
+		return Value();
+	if ( l.array->packed )
+		return kernel_min( l.array->ints.data(), l.array->ints.size() );
+
+	Value result = l.array->values[ 0 ];
+	for ( const Value &entry : l.array->values )
+	{
+		if ( entry < result )
+			result = entry;
+	}
+	return result;
+}
+
+static Value BuiltInNode_Array_Max( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "max", args, 0 );
+	Value &l = self.deref();
+
+	if ( l.array_count() == 0 )
+		return Value();
+	if ( l.array->packed )
+		return kernel_max( l.array->ints.data(), l.array->ints.size() );
+
+	Value result = l.array->values[ 0 ];
+	for ( const Value &entry : l.array->values )
+	{
+		if ( result < entry )
+			result = entry;
+	}
+	return result;
+}
+
+static i64 array_index_of( Interpreter *interpreter, Value &self, Node *args, const char *name )
+{
+	interpreter->expect_arg( name, args, 1 );
+	Value &l = self.deref();
+	Value needle = interpreter->run( args->children[ 0 ] );
+	const Value &value = needle.deref();
+
+	if ( l.array->packed && value.type == ValueType::NumberI64 )
+		return kernel_index_of( l.array->ints.data(), l.array->ints.size(), value.valueI64 );
+
+	for ( u64 i = 0, count = l.array_count(); i < count; ++i )
+	{
+		if ( entry_of( l, i ) == value )
+			return static_cast<i64>( i );
+	}
+	return -1;
+}
+
+static Value BuiltInNode_Array_IndexOf( Interpreter *interpreter, Value &self, Node *args )
+{
+	return array_index_of( interpreter, self, args, "index_of" );
+}
+
+static Value BuiltInNode_Array_Contains( Interpreter *interpreter, Value &self, Node *args )
+{
+	return static_cast<i32>( array_index_of( interpreter, self, args, "contains" ) >= 0 );
+}
+
+static Value BuiltInNode_Array_Fill( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "fill", args, 1 );
+	Value &l = self.deref();
+	Value fill = interpreter->run( args->children[ 0 ] );
+	const Value &value = fill.deref();
+	u64 count = l.array_count();
+
+	if ( value.type == ValueType::NumberI64 )
 	{
-		std::ranges::sort( l.arr, std::ranges::less() );
+		l.array->values.clear();
+		l.array->ints.assign( count, value.valueI64 );
+		l.array->packed = true;
 	}
-	else if ( interpreter->run( args->children[ 0 ] ).get_as_bool( interpreter, args ) )
+	else
 	{
-		std::ranges::sort( l.arr, std::ranges::less() );
+		l.unpack();
+		l.array->values.assign( count, value );
 	}
+
+	return 0;
+}
+
+static Value BuiltInNode_Array_Reverse( Interpreter *interpreter, Value &self, Node *args )
+{
+	interpreter->expect_arg( "reverse", args, 0 );
+	Value &l = self.deref();
+
+	if ( l.array->packed )
+		std::ranges::reverse( l.array->ints );
 	else
+		std::ranges::reverse( l.array->values );
+
+	return 0;
+}
+
+// Applies op entry by entry, with the matching entry of an array of the same
+// size or with a single value
+static Value array_elementwise( Interpreter *interpreter, Value &self, Node *args, const char *name, TokenID op )
+{
+	interpreter->expect_arg( name, args, 1 );
+	Value &l = self.deref();
+	Value operand = interpreter->run( args->children[ 0 ] );
+	const Value &r = operand.deref();
+	u64 count = l.array_count();
+
+	if ( r.type == ValueType::Arr )
 	{
-		std::ranges::sort( l.arr, std::ranges::greater() );
+		if ( r.array_count() != count )
+			interpreter->fatal( RESULT_CODE_INVALID_ARGS_BUILTIN_FUNC, args, "{} expects an array of {} entries, got {}.", name, count, r.array_count() );
+
+		if ( l.array->packed && r.array->packed )
+		{
+			kernel_elementwise( l.array->ints.data(), r.array->ints.data(), count, op );
+			return 0;
+		}
+	}
+	else if ( l.array->packed && r.type == ValueType::NumberI64 )
+	{
+		kernel_elementwise( l.array->ints.data(), r.valueI64, count, op );
+		return 0;
+	}
+
+	l.unpack();
+
+	for ( u64 i = 0; i < count; ++i )
+	{
+		Value rhs = ( r.type == ValueType::Arr ) ? entry_of( r, i ) : r;
+		Value &entry = l.array->values[ i ];
+
+		switch ( op )
+		{
+		case TokenID::Plus:		entry += rhs; break;
+		case TokenID::Asterisk:	entry *= rhs; break;
+		case TokenID::Amp:		entry &= rhs; break;
+		case TokenID::Pipe:		entry |= rhs; break;
+		}
 	}
 
 	return 0;
 }
 
+static Value BuiltInNode_Array_Add( Interpreter *interpreter, Value &self, Node *args )
+{
+	return array_elementwise( interpreter, self, args, "add", TokenID::Plus );
+}
+
+static Value BuiltInNode_Array_Mul( Interpreter *interpreter, Value &self, Node *args )
+{
+	return array_elementwise( interpreter, self, args, "mul", TokenID::Asterisk );
+}
+
+static Value BuiltInNode_Array_And( Interpreter *interpreter, Value &self, Node *args )
+{
+	return array_elementwise( interpreter, self, args, "and", TokenID::Amp );
+}
+
+static Value BuiltInNode_Array_Or( Interpreter *interpreter, Value &self, Node *args )
+{
+	return array_elementwise( interpreter, self, args, "or", TokenID::Pipe );
+}
+
 static Value BuiltInNode_Struct_Count( Interpreter *interpreter, Value &self, Node *args )
 {
 	interpreter->expect_arg( "count", args, 0 );
 	return static_cast<i64>( self.deref().map.size() );
 }
 
+const InternedString *intern( std::string_view text )
+{
+	// never freed, so the keys can view the text they own
+	static std::unordered_map<std::string_view, InternedString*> table;
+
+	auto iter = table.find( text );
+	if ( iter != table.end() )
+		return iter->second;
+
+	InternedString *str = new InternedString{ std::string( text ), std::hash<std::string_view>{}( text ) };
+	table.emplace( str->text, str );
+	return str;
+}
+
+Shape *Shape::root()
+{
+	static Shape rootShape;
+	return &rootShape;
+}
+
+Shape *Shape::add( const InternedString *name )
+{
+	if ( names.size() >= ShapeMaxFields )
+		return nullptr;
+
+	auto iter = transitions.find( name );
+	if ( iter != transitions.end() )
+		return iter->second;
+
+	Shape *shape = new Shape;
+	shape->parent = this;
+	shape->slots = slots;
+	shape->names = names;
+	shape->slots[ name ] = static_cast<u32>( names.size() );
+	shape->names.push_back( name );
+	transitions[ name ] = shape;
+	return shape;
+}
+
+i32 Shape::find( const InternedString *name ) const
+{
+	auto iter = slots.find( name );
+	if ( iter != slots.end() )
+		return static_cast<i32>( iter->second );
+	return -1;
+}
+
+StructMap::Entry StructMap::Iterator::operator * () const
+{
+	return { map->name( index ), *map->fields[ index ] };
+}
+
+StructMap::StructMap( const StructMap &rhs )
+	: shape( rhs.shape )
+	, dictionary( rhs.dictionary ? new StructDictionary( *rhs.dictionary ) : nullptr )
+{
+	fields.reserve( rhs.fields.size() );
+	for ( Value *field : rhs.fields )
+		fields.push_back( new Value( *field ) );
+}
+
+StructMap::StructMap( StructMap &&rhs ) noexcept
+	: shape( rhs.shape )
+	, dictionary( rhs.dictionary )
+	, fields( std::move( rhs.fields ) )
+{
+	rhs.shape = nullptr;
+	rhs.dictionary = nullptr;
+	rhs.fields.clear();
+}
+
+StructMap::~StructMap()
+{
+	clear();
+}
+
+StructMap & StructMap::operator = ( const StructMap &rhs )
+{
+	if ( this != &rhs )
+	{
+		StructMap copy( rhs );
+		*this = std::move( copy );
+	}
+	return *this;
+}
+
+StructMap & StructMap::operator = ( StructMap &&rhs ) noexcept
+{
+	if ( this != &rhs )
+	{
+		clear();
+		shape = rhs.shape;
+		dictionary = rhs.dictionary;
+		fields = std::move( rhs.fields );
+		rhs.shape = nullptr;
+		rhs.dictionary = nullptr;
+		rhs.fields.clear();
+	}
+	return *this;
+}
+
+Value & StructMap::operator [] ( const std::string &name )
+{
+	return ( *this )[ intern( name ) ];
+}
+
+Value & StructMap::operator [] ( const InternedString *name )
+{
+	i32 index = index_of( name );
+	if ( index >= 0 )
+		return *fields[ index ];
+	return add( name );
+}
+
+Value *StructMap::find( const std::string &name ) const
+{
+	i32 index = index_of( intern( name ) );
+	if ( index >= 0 )
+		return fields[ index ];
+	return nullptr;
+}
+
+Value *StructMap::find( const InternedString *name, ShapeCache &cache ) const
+{
+	if ( cache.shape && cache.shape == shape && !cache.transition )
+		return fields[ cache.slot ];
+
+	i32 index = index_of( name );
+	if ( index < 0 )
+		return nullptr;
+
+	cache.shape = shape;
+	cache.transition = nullptr;
+	cache.slot = static_cast<u32>( index );
+	return fields[ index ];
+}
+
+Value &StructMap::get_or_add( const InternedString *name, ShapeCache &cache )
+{
+	if ( cache.shape && cache.shape == shape )
+	{
+		if ( !cache.transition )
+			return *fields[ cache.slot ];
+		shape = cache.transition;
+		fields.push_back( new Value );
+		return *fields.back();
+	}
+
+	i32 index = index_of( name );
+	if ( index >= 0 )
+	{
+		cache.shape = shape;
+		cache.transition = nullptr;
+		cache.slot = static_cast<u32>( index );
+		return *fields[ index ];
+	}
+
+	Shape *from = shape;
+	Value &value = add( name );
+
+	if ( from && shape )
+	{
+		cache.shape = from;
+		cache.transition = shape;
+		cache.slot = static_cast<u32>( fields.size() - 1 );
+	}
+
+	return value;
+}
+
+const std::string &StructMap::name( u32 index ) const
+{
+	if ( dictionary )
+		return dictionary->names[ index ]->text;
+	return shape->names[ index ]->text;
+}
+
+void StructMap::clear()
+{
+	for ( Value *field : fields )
+		delete field;
+	fields.clear();
+	delete dictionary;
+	dictionary = nullptr;
+	shape = nullptr;
+}
+
+i32 StructMap::index_of( const InternedString *name ) const
+{
+	if ( dictionary )
+	{
+		auto iter = dictionary->slots.find( name );
+		if ( iter != dictionary->slots.end() )
+			return static_cast<i32>( iter->second );
+		return -1;
+	}
+
+	if ( shape )
+		return shape->find( name );
+
+	return -1;
+}
+
+Value &StructMap::add( const InternedString *name )
+{
+	if ( !dictionary )
+	{
+		Shape *next = ( shape ? shape : Shape::root() )->add( name );
+
+		if ( next )
+		{
+			shape = next;
+			fields.push_back( new Value );
+			return *fields.back();
+		}
+
+		// Too many fields to keep sharing shapes, move to a private index
+		dictionary = new StructDictionary;
+		dictionary->slots = shape->slots;
+		dictionary->names = shape->names;
+		shape = nullptr;
+	}
+
+	dictionary->slots[ name ] = static_cast<u32>( fields.size() );
+	dictionary->names.push_back( name );
+	fields.push_back( new Value );
+	return *fields.back();
+}
+
 Value::Value( ValueType type )
 	: type( type )
 	, scope( SCOPE_UNSET )
@@ -104,19 +806,190 @@ Value::Value( ValueType type )
 		break;
 
 	case ValueType::Arr:
-		map[ "push" ] = BuiltInNode_Array_Push;
-		map[ "pop" ] = BuiltInNode_Array_Pop;
-		map[ "count" ] = BuiltInNode_Array_Count;
-		map[ "sort" ] = BuiltInNode_Array_Sort;
+		array = new Array;
+		break;
+
+	case ValueType::Dict:
+		collection = new Dict;
+		break;
+
+	case ValueType::Deque:
+		collection = new Deque;
+		break;
+
+	case ValueType::Heap:
+		collection = new Heap;
+		break;
+
+	case ValueType::StrBuf:
+		collection = new StrBuf;
+		break;
+
+	case ValueType::Bytes:
+		// set by bytes_value
+		collection = nullptr;
 		break;
 	}
 }
 
-Value & Value::operator = ( const Value &rhs )
+static void add_array_methods( StructMap &methods )
 {
-	Value &l = deref();
-	const Value &r = rhs.deref();
+	methods[ "push" ] = BuiltInNode_Array_Push;
+	methods[ "pop" ] = BuiltInNode_Array_Pop;
+	methods[ "count" ] = BuiltInNode_Array_Count;
+	methods[ "sort" ] = BuiltInNode_Array_Sort;
+	methods[ "sort_by" ] = BuiltInNode_Array_SortBy;
+	methods[ "sum" ] = BuiltInNode_Array_Sum;
+	methods[ "min" ] = BuiltInNode_Array_Min;
+	methods[ "max" ] = BuiltInNode_Array_Max;
+	methods[ "index_of" ] = BuiltInNode_Array_IndexOf;
+	methods[ "contains" ] = BuiltInNode_Array_Contains;
+	methods[ "fill" ] = BuiltInNode_Array_Fill;
+	methods[ "reverse" ] = BuiltInNode_Array_Reverse;
+	methods[ "add" ] = BuiltInNode_Array_Add;
+	methods[ "mul" ] = BuiltInNode_Array_Mul;
+	methods[ "and" ] = BuiltInNode_Array_And;
+	methods[ "or" ] = BuiltInNode_Array_Or;
+}
+
+static void add_dict_methods( StructMap &methods )
+{
+	methods[ "get" ] = BuiltInNode_Dict_Get;
+	methods[ "set" ] = BuiltInNode_Dict_Set;
+	methods[ "has" ] = BuiltInNode_Dict_Has;
+	methods[ "remove" ] = BuiltInNode_Dict_Remove;
+	methods[ "count" ] = BuiltInNode_Dict_Count;
+}
+
+static void add_deque_methods( StructMap &methods )
+{
+	methods[ "push_front" ] = BuiltInNode_Deque_PushFront;
+	methods[ "push_back" ] = BuiltInNode_Deque_PushBack;
+	methods[ "pop_front" ] = BuiltInNode_Deque_PopFront;
+	methods[ "pop_back" ] = BuiltInNode_Deque_PopBack;
+	methods[ "count" ] = BuiltInNode_Deque_Count;
+}
+
+static void add_heap_methods( StructMap &methods )
+{
+	methods[ "push" ] = BuiltInNode_Heap_Push;
+	methods[ "pop" ] = BuiltInNode_Heap_Pop;
+	methods[ "peek" ] = BuiltInNode_Heap_Peek;
+	methods[ "count" ] = BuiltInNode_Heap_Count;
+}
+
+static void add_strbuf_methods( StructMap &methods )
+{
+	methods[ "append" ] = BuiltInNode_StrBuf_Append;
+	methods[ "str" ] = BuiltInNode_StrBuf_Str;
+	methods[ "count" ] = BuiltInNode_StrBuf_Count;
+	methods[ "clear" ] = BuiltInNode_StrBuf_Clear;
+}
+
+static void add_bytes_methods( StructMap &methods )
+{
+	methods[ "count" ] = BuiltInNode_Bytes_Count;
+	methods[ "str" ] = BuiltInNode_Bytes_Str;
+	methods[ "slice" ] = BuiltInNode_Bytes_Slice;
+}
+
+// Methods every value of a type shares, found after the value's own fields,
+// so a value doesn't carry a field per builtin
+StructMap *builtin_methods( ValueType type )
+{
+	static StructMap arrayMethods;
+	static StructMap dictMethods;
+	static StructMap dequeMethods;
+	static StructMap heapMethods;
+	static StructMap strbufMethods;
+	static StructMap bytesMethods;
+
+	switch ( type )
+	{
+	case ValueType::Arr:
+		if ( arrayMethods.empty() )
+			add_array_methods( arrayMethods );
+		return &arrayMethods;
+
+	case ValueType::Dict:
+		if ( dictMethods.empty() )
+			add_dict_methods( dictMethods );
+		return &dictMethods;
+
+	case ValueType::Deque:
+		if ( dequeMethods.empty() )
+			add_deque_methods( dequeMethods );
+		return &dequeMethods;
+
+	case ValueType::Heap:
+		if ( heapMethods.empty() )
+			add_heap_methods( heapMethods );
+		return &heapMethods;
+
+	case ValueType::StrBuf:
+		if ( strbufMethods.empty() )
+			add_strbuf_methods( strbufMethods );
+		return &strbufMethods;
+
+	case ValueType::Bytes:
+		if ( bytesMethods.empty() )
+			add_bytes_methods( bytesMethods );
+		return &bytesMethods;
+	}
+
+	return nullptr;
+}
+
+std::string collection_string( const Value &value )
+{
+	return value.collection ? value.collection->to_string() : "";
+}
+
+static bool holds_collection( ValueType type )
+{
+	switch ( type )
+	{
+	case ValueType::Dict:
+	case ValueType::Deque:
+	case ValueType::Heap:
+	case ValueType::StrBuf:
+	case ValueType::Bytes:
+		return true;
+	}
+	return false;
+}
+
+static Collection *collection_of( const Value &value )
+{
+	return holds_collection( value.type ) ? value.collection : nullptr;
+}
+
+static Array *array_of( const Value &value )
+{
+	return value.type == ValueType::Arr ? value.array : nullptr;
+}
+
+// Arrays are copied by value, a moved from array has none to copy
+static Array *copy_array( const Array *array )
+{
+	return array ? new Array( *array ) : nullptr;
+}
+
+static void retain( Collection *collection )
+{
+	if ( collection )
+		collection->refs += 1;
+}
+
+static void release( Collection *collection )
+{
+	if ( collection && --collection->refs == 0 )
+		delete collection;
+}
 
+// Copies the union without counting a collection or copying an array, the callers do
+static void assign_union( Value &l, const Value &r )
+{
 	l.type = r.type;
 
 	switch ( l.type )
@@ -128,18 +1001,102 @@ Value & Value::operator = ( const Value &rhs )
 	case ValueType::Node: l.valueNode = r.valueNode; break;
 	case ValueType::InbuiltFunc: l.valueInbuiltFunc = r.valueInbuiltFunc; break;
 	case ValueType::Reference: l.valueRef = r.valueRef; break;
-	case ValueType::File: break;
+	case ValueType::File: l.fileId = r.fileId; break;
 	case ValueType::Command: l.keywordID = r.keywordID; break;
+	case ValueType::Dict: l.collection = r.collection; break;
+	case ValueType::Deque: l.collection = r.collection; break;
+	case ValueType::Heap: l.collection = r.collection; break;
+	case ValueType::StrBuf: l.collection = r.collection; break;
+	case ValueType::Bytes: l.collection = r.collection; break;
+	case ValueType::Arr: l.array = r.array; break;
 	}
+}
+
+Value::Value( const Value &rhs )
+	: type( ValueType::Undefined )
+	, scope( rhs.scope )
+	, valueString( rhs.valueString )
+	, map( rhs.map )
+{
+	assign_union( *this, rhs );
+	retain( collection_of( *this ) );
+	if ( type == ValueType::Arr )
+		array = copy_array( rhs.array );
+}
+
+// A collection or an array changes hands without being counted or copied
+Value::Value( Value &&rhs ) noexcept
+	: type( ValueType::Undefined )
+	, scope( rhs.scope )
+	, valueString( std::move( rhs.valueString ) )
+	, map( std::move( rhs.map ) )
+{
+	assign_union( *this, rhs );
+	if ( holds_collection( rhs.type ) )
+		rhs.collection = nullptr;
+	else if ( rhs.type == ValueType::Arr )
+		rhs.array = nullptr;
+}
+
+Value::~Value()
+{
+	release( collection_of( *this ) );
+	delete array_of( *this );
+}
+
+// What l held is let go last, r may live inside it
+Value & Value::operator = ( const Value &rhs )
+{
+	Value &l = deref();
+	const Value &r = rhs.deref();
+
+	// copied before l changes, l may be an entry of r
+	Array *copied = ( r.type == ValueType::Arr ) ? copy_array( r.array ) : nullptr;
+	Collection *previous = collection_of( l );
+	Array *previousArray = array_of( l );
+	assign_union( l, r );
+	retain( collection_of( l ) );
+	if ( l.type == ValueType::Arr )
+		l.array = copied;
 
-	l.file = r.file;
 	l.valueString = r.valueString;
-	l.arr = r.arr;
 	l.map = r.map;
 
-	for ( auto &entry : l.map )
+	for ( auto entry : l.map )
+		entry.second.update_parent( &l );
+
+	release( previous );
+	delete previousArray;
+	return *this;
+}
+
+// A temporary that doesn't refer to another value can't be seen by anything
+// else, so its containers are taken instead of copied
+Value & Value::operator = ( Value &&rhs )
+{
+	if ( rhs.type == ValueType::Reference )
+		return *this = static_cast<const Value &>( rhs );
+
+	Value &l = deref();
+	if ( &l == &rhs )
+		return *this;
+
+	Collection *previous = collection_of( l );
+	Array *previousArray = array_of( l );
+	assign_union( l, rhs );
+	if ( holds_collection( rhs.type ) )
+		rhs.collection = nullptr;
+	else if ( rhs.type == ValueType::Arr )
+		rhs.array = nullptr;
+
+	l.valueString = std::move( rhs.valueString );
+	l.map = std::move( rhs.map );
+
+	for ( auto entry : l.map )
 		entry.second.update_parent( &l );
 
+	release( previous );
+	delete previousArray;
 	return *this;
 }
 
@@ -148,13 +1105,90 @@ Value Value::operator [] ( i64 index )
 	if ( type == ValueType::Reference )
 		return (*this->valueRef)[ index ];
 
+	if ( type == ValueType::Bytes )
+	{
+		std::string_view bytes = static_cast<const ByteView &>( *collection ).bytes;
+		if ( index < 0 || index >= static_cast<i64>( bytes.size() ) )
+			value_fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, "Attempting to access subscript of value out of bounds[ {} ]. ( Bytes of {} ).", index, bytes.size() );
+		return static_cast<i32>( static_cast<u8>( bytes[ index ] ) );
+	}
+
 	if ( type != ValueType::Arr )
 		value_fatal( RESULT_CODE_VALUE_SUBSCRIPT_OF_NON_ARRAY, "Attempting to access subscript of value that isn't an array. ( {} ).", *this );
 
-	if ( index < 0 || index >= static_cast<i64>( arr.size() ) )
+	if ( index < 0 || index >= static_cast<i64>( array_count() ) )
 		value_fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, "Attempting to access subscript of value out of bounds[ {} ]. ( {} ).", index, *this );
 
-	return &arr[ index ];
+	// there is no Value to refer to, writes go through array_store
+	if ( array->packed )
+		return array->ints[ index ];
+
+	return &array->values[ index ];
+}
+
+u64 Value::array_count() const
+{
+	return array->packed ? array->ints.size() : array->values.size();
+}
+
+// Entries are stored by value, a variable pushed in is copied rather than referred to
+void Value::array_push( const Value &value )
+{
+	const Value &entry = value.deref();
+
+	if ( array->packed )
+	{
+		if ( entry.type == ValueType::NumberI64 )
+		{
+			array->ints.push_back( entry.valueI64 );
+			return;
+		}
+		unpack();
+	}
+
+	array->values.push_back( entry );
+}
+
+void Value::array_store( i64 index, const Value &value )
+{
+	if ( index < 0 || index >= static_cast<i64>( array_count() ) )
+		value_fatal( RESULT_CODE_VALUE_SUBSCRIPT_OUT_OF_RANGE, "Attempting to access subscript of value out of bounds[ {} ]. ( {} ).", index, *this );
+
+	const Value &entry = value.deref();
+
+	if ( array->packed )
+	{
+		if ( entry.type == ValueType::NumberI64 )
+		{
+			array->ints[ index ] = entry.valueI64;
+			return;
+		}
+		unpack();
+	}
+
+	array->values[ index ] = entry;
+}
+
+void Value::array_clear()
+{
+	array->values.clear();
+	array->ints.clear();
+	array->packed = true;
+}
+
+// Back to one Value per entry, for an array that is given something other than an i64
+void Value::unpack()
+{
+	if ( !array->packed )
+		return;
+
+	array->values.reserve( array->values.size() + array->ints.size() );
+	for ( i64 entry : array->ints )
+		array->values.emplace_back( entry );
+
+	array->ints.clear();
+	array->ints.shrink_to_fit();
+	array->packed = false;
 }
 
 void Value::update_parent( Value *parent )
@@ -163,14 +1197,22 @@ void Value::update_parent( Value *parent )
 		return;
 
 	Value &value = map[ "parent" ];
+	if ( value.type != ValueType::Reference )
+		value.clear();
 	value.type = ValueType::Reference;
 	value.scope = SCOPE_STRUCT;
 	value.valueRef = parent;
 
-	for ( auto &entry : map )
+	for ( auto entry : map )
 		entry.second.update_parent( this );
 }
 
+// Still open, rather than closed through this value or a copy of it
+static bool file_open( Interpreter *interpreter, u64 fileId )
+{
+	return interpreter ? interpreter->fileTable.get( fileId ) != nullptr : fileId != 0;
+}
+
 bool Value::get_as_bool( Interpreter *interpreter, Node *node )
 {
 	switch ( type )
@@ -180,14 +1222,19 @@ bool Value::get_as_bool( Interpreter *interpreter, Node *node )
 	case ValueType::NumberI64: return valueI64 != 0;
 	case ValueType::StringLiteral: return !valueString.empty();
 	case ValueType::Struct: return !map.empty();
-	case ValueType::Arr: return !arr.empty();
+	case ValueType::Arr: return array_count() != 0;
 	case ValueType::TokenID: return false;
 	case ValueType::KeywordID: return false;
 	case ValueType::Node: return valueNode;
 	case ValueType::InbuiltFunc: return false;
 	case ValueType::Reference: return valueRef->get_as_bool( interpreter, node );
-	case ValueType::File: return file && file->is_open();
+	case ValueType::File: return file_open( interpreter, fileId );
 	case ValueType::Command: return false;
+	case ValueType::Dict: return collection->count() != 0;
+	case ValueType::Deque: return collection->count() != 0;
+	case ValueType::Heap: return collection->count() != 0;
+	case ValueType::StrBuf: return collection->count() != 0;
+	case ValueType::Bytes: return collection->count() != 0;
 	}
 
 	value_fatal( RESULT_CODE_VALUE_CANNOT_CONVERT, interpreter, node, "Cannot convert from {} to bool.", *this );
@@ -217,7 +1264,7 @@ i32 Value::get_as_i32( Interpreter *interpreter, Node *node )
 		return valueRef->get_as_i32( interpreter, node );
 
 	case ValueType::File:
-		return file && file->is_open();
+		return file_open( interpreter, fileId );
 	}
 
 	value_fatal( RESULT_CODE_VALUE_CANNOT_CONVERT, interpreter, node, "Cannot convert from {} to i32.", *this );
@@ -247,7 +1294,7 @@ i64 Value::get_as_i64( Interpreter *interpreter, Node *node )
 		return valueRef->get_as_i64( interpreter, node );
 
 	case ValueType::File:
-		return file && file->is_open();
+		return file_open( interpreter, fileId );
 	}
 
 	value_fatal( RESULT_CODE_VALUE_CANNOT_CONVERT, interpreter, node, "Cannot convert from {} to i64.", *this );
@@ -263,6 +1310,8 @@ std::string Value::get_as_string( Interpreter *interpreter, Node *node )
 	case ValueType::StringLiteral: return valueString;
 	case ValueType::Reference: return valueRef->get_as_string( interpreter, node );
 	case ValueType::File: return valueString;
+	case ValueType::StrBuf: return static_cast<StrBuf &>( *collection ).str();
+	case ValueType::Bytes: return collection->to_string();
 	}
 
 	value_fatal( RESULT_CODE_VALUE_CANNOT_CONVERT, interpreter, node, "Cannot convert from {} to string.", *this );
@@ -277,7 +1326,7 @@ i64 Value::count() const
 	case ValueType::NumberI64: return 0;
 	case ValueType::StringLiteral: return valueString.size();
 	case ValueType::Struct: return map.size();
-	case ValueType::Arr: return arr.size();
+	case ValueType::Arr: return array_count();
 	case ValueType::TokenID: return 0;
 	case ValueType::KeywordID: return 0;
 	case ValueType::Node: return 0;
@@ -285,16 +1334,21 @@ i64 Value::count() const
 	case ValueType::Reference: return valueRef->count();
 	case ValueType::File: return 0;
 	case ValueType::Command: return 0;
+	case ValueType::Dict: return collection->count();
+	case ValueType::Deque: return collection->count();
+	case ValueType::Heap: return collection->count();
+	case ValueType::StrBuf: return collection->count();
+	case ValueType::Bytes: return collection->count();
 	}
 	return 0;
 }
 
 void Value::clear()
 {
+	release( collection_of( *this ) );
+	delete array_of( *this );
 	type = ValueType::Undefined;
-	file.reset();
 	valueString.clear();
-	arr.clear();
 	map.clear();
 }
 
@@ -312,6 +1366,22 @@ const Value &Value::deref() const
 	return *this;
 }
 
+bool is_text( ValueType type )
+{
+	return type == ValueType::StringLiteral || type == ValueType::StrBuf || type == ValueType::Bytes;
+}
+
+// A builder is flattened on the first read, a view is used in place
+std::string_view text_view( const Value &value )
+{
+	switch ( value.type )
+	{
+	case ValueType::StrBuf: return static_cast<const StrBuf &>( *value.collection ).str();
+	case ValueType::Bytes: return static_cast<const ByteView &>( *value.collection ).bytes;
+	}
+	return value.valueString;
+}
+
 bool operator == ( const Value &lhs, const Value &rhs )
 {
 	const Value &l = lhs.deref();
@@ -330,6 +1400,10 @@ bool operator == ( const Value &lhs, const Value &rhs )
 	case TYPE_PAIR( ValueType::StringLiteral, ValueType::StringLiteral ):	return l.valueString == r.valueString;
 	}
 
+	// builders and byte views compare as the text they hold
+	if ( is_text( l.type ) && is_text( r.type ) )
+		return text_view( l ) == text_view( r );
+
 	value_fatal( RESULT_CODE_VALUE_UNDEFINED_COMPARITOR, "Unhandled value '==' types( {}, {} )", l.type, r.type );
 }
 
@@ -839,13 +1913,11 @@ ToIntResult to_int( u64 *value, char const *str, char **endOut, i32 base )
 {
 	char *end;
 	errno = 0;
-	u64 l = strtoul( str, &end, base );
+	u64 l = strtoull( str, &end, base );
 	if ( endOut )
 		*endOut = end;
-	if ( ( errno == ERANGE && l == LONG_MAX ) || l > INT_MAX )
+	if ( errno == ERANGE )
 		return ToIntResult::Overflow;
-	if ( ( errno == ERANGE && l == LONG_MIN ) || l < INT_MIN )
-		return ToIntResult::Underflow;
 	if ( *str == '\0' )
 		return ToIntResult::Failed;
 	*value = l;
@@ -3,7 +3,9 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <memory>
 #include <iosfwd>
 #include <print>
 
@@ -13,6 +15,9 @@
 
 struct Node;
 struct Interpreter;
+struct Value;
+struct Collection;
+struct Array;
 
 constexpr i32 TypeShift = 16;
 
@@ -26,6 +31,110 @@ enum SCOPE
 	SCOPE_GLOBAL = 0,
 };
 
+// Structs that gain more fields than this stop sharing shapes and
+// keep their own field index instead
+constexpr u32 ShapeMaxFields = 64;
+
+// Packed arrays at least this long are radix sorted
+constexpr u64 RadixSortMin = 256;
+// Arrays at least this long per thread are sorted in chunks on separate threads
+constexpr u64 ParallelSortMin = 1 << 16;
+
+// Text kept once for the whole run. Equal text always interns to the same
+// InternedString, so names compare by pointer and hash by the stored hash.
+struct InternedString
+{
+	std::string text;
+	u64 hash;
+};
+
+struct InternedHash
+{
+	u64 operator () ( const InternedString *str ) const { return str->hash; }
+};
+
+const InternedString *intern( std::string_view text );
+
+using InternedSlots = std::unordered_map<const InternedString*, u32, InternedHash>;
+
+// Hidden class describing the field layout of a struct. Structs that gain the
+// same fields in the same order share a Shape, found through the transitions.
+struct Shape
+{
+	Shape *parent = nullptr;
+	InternedSlots slots = {};
+	std::vector<const InternedString*> names = {};
+	std::unordered_map<const InternedString*, Shape*, InternedHash> transitions = {};
+
+	static Shape *root();
+
+	Shape *add( const InternedString *name );
+	i32 find( const InternedString *name ) const;
+};
+
+// Per access site cache of a field lookup. When a struct has the cached shape
+// the field is at the cached slot, or gets added by moving to the transition.
+struct ShapeCache
+{
+	Shape *shape;
+	Shape *transition;
+	u32 slot;
+};
+
+struct StructDictionary
+{
+	InternedSlots slots;
+	std::vector<const InternedString*> names;
+};
+
+struct StructMap
+{
+	struct Entry
+	{
+		const std::string &first;
+		Value &second;
+	};
+
+	struct Iterator
+	{
+		const StructMap *map;
+		u32 index;
+
+		Entry operator * () const;
+		Iterator &operator ++ () { ++index; return *this; }
+		bool operator != ( const Iterator &rhs ) const { return index != rhs.index; }
+	};
+
+	Shape *shape = nullptr;
+	StructDictionary *dictionary = nullptr;
+	std::vector<Value*> fields;
+
+	StructMap() = default;
+	StructMap( const StructMap &rhs );
+	StructMap( StructMap &&rhs ) noexcept;
+	~StructMap();
+
+	StructMap & operator = ( const StructMap &rhs );
+	StructMap & operator = ( StructMap &&rhs ) noexcept;
+	Value & operator [] ( const std::string &name );
+	Value & operator [] ( const InternedString *name );
+
+	Value *find( const std::string &name ) const;
+	Value *find( const InternedString *name, ShapeCache &cache ) const;
+	Value &get_or_add( const InternedString *name, ShapeCache &cache );
+	const std::string &name( u32 index ) const;
+	u64 size() const { return fields.size(); }
+	bool empty() const { return fields.empty(); }
+	void clear();
+
+	Iterator begin() const { return { this, 0 }; }
+	Iterator end() const { return { this, static_cast<u32>( fields.size() ) }; }
+
+private:
+	i32 index_of( const InternedString *name ) const;
+	Value &add( const InternedString *name );
+};
+
 struct Value
 {
 	using InBuiltFunc = Value (*)( Interpreter *interpreter, Value &self, Node *args );
@@ -42,12 +151,16 @@ struct Value
 		Node *valueNode;
 		Value *valueRef;
 		InBuiltFunc valueInbuiltFunc;
+		// an id in the interpreter's FileTable
+		u64 fileId;
+		// Dict, Deque, Heap, StrBuf and Bytes, counted in Collection::refs
+		Collection *collection;
+		// Arr, copied with the value
+		Array *array;
 	};
 
-	std::shared_ptr<std::fstream> file;
 	std::string valueString;
-	std::vector<Value> arr;
-	std::unordered_map<std::string, Value> map;
+	StructMap map;
 
 	// -- --
 	Value()
@@ -85,6 +198,13 @@ struct Value
 	{
 	}
 
+	Value( std::string &&str )
+		: type( ValueType::StringLiteral )
+		, scope( SCOPE_UNSET )
+		, valueString( std::move( str ) )
+	{
+	}
+
 	Value( const char *str )
 		: type( ValueType::StringLiteral )
 		, scope( SCOPE_UNSET )
@@ -136,19 +256,20 @@ struct Value
 	{
 	}
 
-	Value( std::string &name, std::fstream &fileStream )
-		: type( ValueType::File )
-		, scope( SCOPE_UNSET )
-		, file( std::make_shared<std::fstream>() )
-		, valueString( name )
-	{
-		*file = std::move( fileStream );
-	}
+	Value( const Value &rhs );
+	Value( Value &&rhs ) noexcept;
+	~Value();
 
 	Value & operator = ( const Value &rhs );
+	Value & operator = ( Value &&rhs );
 	Value operator [] ( i64 index );
 
 	void update_parent( Value *parent );
+	u64 array_count() const;
+	void array_push( const Value &value );
+	void array_store( i64 index, const Value &value );
+	void array_clear();
+	void unpack();
 	bool get_as_bool( Interpreter *interpreter, Node *node );
 	i32 get_as_i32( Interpreter *interpreter, Node *node );
 	i64 get_as_i64( Interpreter *interpreter, Node *node );
@@ -160,6 +281,20 @@ struct Value
 	void unfold();
 };
 
+// Arrays start packed, entries live in ints while every one is an i64
+struct Array
+{
+	std::vector<i64> ints;
+	std::vector<Value> values;
+	bool packed = true;
+};
+
+StructMap *builtin_methods( ValueType type );
+std::string collection_string( const Value &value );
+// Strings, builders and byte views, and their text without a copy
+bool is_text( ValueType type );
+std::string_view text_view( const Value &value );
+
 bool operator == ( const Value &lhs, const Value &rhs );
 bool operator != ( const Value &lhs, const Value &rhs );
 
@@ -227,6 +362,11 @@ struct std::formatter<ValueType>
 		case ValueType::Reference: name = "Reference"; break;
 		case ValueType::File: name = "File"; break;
 		case ValueType::Command: name = "Command"; break;
+		case ValueType::Dict: name = "Dict"; break;
+		case ValueType::Deque: name = "Deque"; break;
+		case ValueType::Heap: name = "Heap"; break;
+		case ValueType::StrBuf: name = "StrBuf"; break;
+		case ValueType::Bytes: name = "Bytes"; break;
 		}
 
 		return std::format_to( ctx.out(), "{}", name );
@@ -253,27 +393,22 @@ struct std::formatter<Value> : std::formatter<string_view>
 		case ValueType::Struct:
 			{
 				std::string temp;
-				temp.reserve( value.arr.size() * 64 );
+				temp.reserve( value.map.size() * 64 );
 				std::format_to( std::back_inserter( temp ), "{{ " );
 				if ( !value.map.empty() )
 				{
-					auto entry = []( std::string &temp, auto iter, bool &f )
+					bool first = true;
+					for ( auto entry : value.map )
 					{
-						if ( iter->first != "parent" )
+						if ( entry.first != "parent" )
 						{
-							if ( f )
-								std::format_to( std::back_inserter( temp ), "{}:{}", iter->first, iter->second );
+							if ( first )
+								std::format_to( std::back_inserter( temp ), "{}:{}", entry.first, entry.second );
 							else
-								std::format_to( std::back_inserter( temp ), ", {}:{}", iter->first, iter->second );
-							f = false;
+								std::format_to( std::back_inserter( temp ), ", {}:{}", entry.first, entry.second );
+							first = false;
 						}
-					};
-
-					bool first = true;
-					auto iter = value.map.begin();
-					entry( temp, iter, first );
-					for ( ++iter; iter != value.map.end(); ++iter )
-						entry( temp, iter, first );
+					}
 				}
 				std::format_to( std::back_inserter( temp ), " }}" );
 				return std::formatter<string_view>::format( temp, ctx );
@@ -283,17 +418,24 @@ struct std::formatter<Value> : std::formatter<string_view>
 		case ValueType::Arr:
 			{
 				std::string temp;
-				temp.reserve( value.arr.size() * 32 );
+				temp.reserve( value.array_count() * 32 );
 				std::format_to( std::back_inserter( temp ), "[ " );
 
-				if ( !value.arr.empty() )
+				const Array &array = *value.array;
+				if ( array.packed && !array.ints.empty() )
+				{
+					std::format_to( std::back_inserter( temp ), "{}", array.ints[ 0 ] );
+					for ( u64 i = 1, count = array.ints.size(); i < count; ++i )
+						std::format_to( std::back_inserter( temp ), ", {}", array.ints[ i ] );
+				}
+				else if ( !array.values.empty() )
 				{
-					std::format_to( std::back_inserter( temp ), "{}", value.arr[ 0 ] );
-					for ( u64 i = 1, count = value.arr.size(); i < count; ++i )
-						std::format_to( std::back_inserter( temp ), ", {}", value.arr[ i ] );
+					std::format_to( std::back_inserter( temp ), "{}", array.values[ 0 ] );
+					for ( u64 i = 1, count = array.values.size(); i < count; ++i )
+						std::format_to( std::back_inserter( temp ), ", {}", array.values[ i ] );
 				}
 
-				std::format_to( std::back_inserter( temp ), "]({})", value.arr.size() );
+				std::format_to( std::back_inserter( temp ), "]({})", value.array_count() );
 
 				return std::formatter<string_view>::format( temp, ctx );
 			}
@@ -306,6 +448,11 @@ struct std::formatter<Value> : std::formatter<string_view>
 		case ValueType::Reference:			return std::format_to( ctx.out(), "{}", *value.valueRef );
 		case ValueType::File:				return std::format_to( ctx.out(), "{}", value.valueString );
 		case ValueType::Command:			return std::format_to( ctx.out(), "{}", Keywords[ static_cast<i32>( value.keywordID ) ].name );
+		case ValueType::Dict:
+		case ValueType::Deque:
+		case ValueType::Heap:
+		case ValueType::StrBuf:
+		case ValueType::Bytes:				return std::formatter<string_view>::format( collection_string( value ), ctx );
 		}
 
 		return std::format_to( ctx.out(), "Unhandled value ValueType( {} )", value.type );
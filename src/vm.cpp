@@ -0,0 +1,951 @@
+
+#include "vm.h"
+#include "interpreter.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sys/resource.h>
+#endif
+
+// -- compiler --
+
+// Jumps out of a loop, or out of the function level statement when no loop
+// encloses them, patched once the code they leave to is known
+struct VmExit
+{
+	// scopes deep the code they leave to runs
+	u32 depth;
+	std::vector<u32> breaks;
+	std::vector<u32> continues;
+};
+
+struct VmCompiler
+{
+	VmChunk *chunk;
+	// scopes the body has pushed at this point
+	u32 depth;
+	std::vector<VmExit> exits;
+
+	u32 emit( VmOp op, Node *node, u32 arg = 0, u32 jump = 0 )
+	{
+		chunk->code.push_back( { op, arg, jump, node } );
+		return static_cast<u32>( chunk->code.size() - 1 );
+	}
+
+	u32 here() const
+	{
+		return static_cast<u32>( chunk->code.size() );
+	}
+
+	void patch( const std::vector<u32> &jumps, u32 target )
+	{
+		for ( u32 at : jumps )
+			chunk->code[ at ].jump = target;
+	}
+
+	void statement( Node *node );
+	void expression( Node *node );
+	u32 condition( Node *node, Node *failNode );
+	void block( Node *node );
+	void arguments( Node *callNode );
+	void call( Node *node );
+	void tail_call( Node *node, Node *callNode );
+	void leave( Node *node, bool isBreak );
+};
+
+// Whether running the node can make a script call. Code that can't is left to
+// the tree walker whole, it never nests deeper than the statement.
+static bool has_call( Node *node )
+{
+	if ( !node )
+		return false;
+	if ( node->type == NodeID::FunctionCall )
+		return true;
+	if ( has_call( node->left ) || has_call( node->right ) )
+		return true;
+	for ( auto child : node->children )
+	{
+		if ( has_call( child ) )
+			return true;
+	}
+	return false;
+}
+
+// Break and continue leave the innermost loop, dropping the scopes pushed
+// inside it. In a function body outside any loop they only skip the rest of
+// the statement, as the tree walker's Command values did.
+void VmCompiler::leave( Node *node, bool isBreak )
+{
+	VmExit &target = exits.back();
+	if ( depth > target.depth )
+		emit( VmOp::ScopePop, node, depth - target.depth );
+	u32 jump = emit( VmOp::Jump, node );
+	( isBreak ? target.breaks : target.continues ).push_back( jump );
+}
+
+// The condition of an If or While, the returned jump is taken when it fails
+u32 VmCompiler::condition( Node *node, Node *failNode )
+{
+	if ( has_call( node->left ) )
+	{
+		expression( node->left );
+		return emit( VmOp::JumpIfFalse, failNode );
+	}
+	if ( node->type == NodeID::IfCompare || node->type == NodeID::WhileCompare )
+		return emit( VmOp::BranchCompare, node );
+	return emit( VmOp::Branch, node );
+}
+
+void VmCompiler::block( Node *node )
+{
+	emit( VmOp::ScopePush, node );
+	depth += 1;
+	for ( auto child : node->children )
+		statement( child );
+	emit( VmOp::ScopePop, node, 1 );
+	depth -= 1;
+}
+
+void VmCompiler::statement( Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::Block:
+		block( node );
+		break;
+
+	case NodeID::If:
+	case NodeID::IfCompare:
+		{
+			u32 skip = condition( node, node );
+			block( node );
+
+			if ( node->right )
+			{
+				u32 over = emit( VmOp::Jump, node );
+				chunk->code[ skip ].jump = here();
+				statement( node->right );
+				chunk->code[ over ].jump = here();
+			}
+			else
+			{
+				chunk->code[ skip ].jump = here();
+			}
+		}
+		break;
+
+	case NodeID::Return:
+		if ( node->left && node->left->type == NodeID::FunctionCall )
+		{
+			tail_call( node, node->left );
+		}
+		else
+		{
+			if ( node->left )
+				expression( node->left );
+			else
+				emit( VmOp::Push, node );
+			emit( VmOp::Return, node );
+		}
+		break;
+
+	case NodeID::ForNumberRange:
+		{
+			emit( VmOp::ForBegin, node );
+			depth += 1;
+			expression( node->right );
+			expression( node->right->right );
+			emit( VmOp::ForRange, node );
+
+			u32 top = emit( VmOp::ForIter, node );
+			exits.push_back( { depth, {}, {} } );
+			for ( auto child : node->children )
+				statement( child );
+			u32 next = emit( VmOp::ForNext, node, 0, top );
+			u32 end = emit( VmOp::LoopEnd, node );
+			depth -= 1;
+
+			chunk->code[ top ].jump = here();
+			patch( exits.back().continues, next );
+			patch( exits.back().breaks, end );
+			exits.pop_back();
+		}
+		break;
+
+	case NodeID::While:
+	case NodeID::WhileCompare:
+		{
+			emit( VmOp::WhileBegin, node );
+			depth += 1;
+			u32 skip = condition( node, node->left );
+			emit( VmOp::WhileInit, node );
+
+			u32 top = emit( VmOp::WhileIter, node );
+			exits.push_back( { depth, {}, {} } );
+			for ( auto child : node->children )
+				statement( child );
+
+			// a condition with calls runs as instructions of its own before the jump back
+			u32 check;
+			if ( has_call( node->left ) )
+			{
+				check = emit( VmOp::WhileCheck, node );
+				u32 done = condition( node, node->left );
+				emit( VmOp::Jump, node, 0, top );
+				chunk->code[ done ].jump = here();
+			}
+			else
+			{
+				check = emit( VmOp::WhileNext, node, top );
+			}
+			u32 end = emit( VmOp::LoopEnd, node );
+			depth -= 1;
+
+			chunk->code[ skip ].jump = end;
+			chunk->code[ check ].jump = end;
+			patch( exits.back().continues, check );
+			patch( exits.back().breaks, end );
+			exits.pop_back();
+		}
+		break;
+
+	case NodeID::Continue:
+		leave( node, false );
+		break;
+
+	case NodeID::Break:
+		leave( node, true );
+		break;
+
+	case NodeID::AssignmentOpConst:
+		if ( node->left->type == NodeID::Identifier )
+		{
+			emit( VmOp::AddConst, node );
+			break;
+		}
+		emit( VmOp::Exec, node );
+		break;
+
+	case NodeID::Assignment:
+	case NodeID::AssignmentOp:
+	case NodeID::FunctionCall:
+		if ( has_call( node ) )
+		{
+			expression( node );
+			emit( VmOp::Pop, node );
+			break;
+		}
+		emit( VmOp::Exec, node );
+		break;
+
+	default:
+		emit( VmOp::Exec, node );
+		break;
+	}
+}
+
+void VmCompiler::expression( Node *node )
+{
+	if ( !has_call( node ) )
+	{
+		emit( VmOp::Eval, node );
+		return;
+	}
+
+	switch ( node->type )
+	{
+	case NodeID::ArrayAccess:
+		expression( node->left );
+		expression( node->right );
+		emit( VmOp::Index, node );
+		break;
+
+	case NodeID::Operation:
+		expression( node->left );
+		expression( node->right );
+		emit( VmOp::Operation, node );
+		break;
+
+	case NodeID::Assignment:
+		expression( node->right );
+		emit( VmOp::Assign, node );
+		break;
+
+	case NodeID::AssignmentOp:
+		if ( node->left->type == NodeID::ArrayAccess )
+		{
+			expression( node->right );
+			emit( VmOp::AssignOpEntry, node );
+		}
+		else
+		{
+			expression( node->left );
+			expression( node->right );
+			emit( VmOp::AssignOp, node );
+		}
+		break;
+
+	case NodeID::FunctionCall:
+		call( node );
+		break;
+
+	default:
+		emit( VmOp::Eval, node );
+		break;
+	}
+}
+
+// Binds the call's arguments into the frame CallBegin pushed
+void VmCompiler::arguments( Node *callNode )
+{
+	for ( u32 argIdx = 0; argIdx < callNode->children.size(); ++argIdx )
+	{
+		Node *arg = callNode->children[ argIdx ];
+		if ( has_call( arg ) )
+		{
+			expression( arg );
+			emit( VmOp::BindArg, callNode, argIdx );
+		}
+		else
+		{
+			emit( VmOp::BindRun, arg, argIdx );
+		}
+	}
+	emit( VmOp::CallEnter, callNode );
+}
+
+void VmCompiler::call( Node *node )
+{
+	u32 begin = emit( VmOp::CallBegin, node );
+	arguments( node );
+	chunk->code[ begin ].jump = here();
+}
+
+// A tail call hands the frame over first and binds its arguments in the
+// callee's scope after, as a normal call does. When the callee can't take
+// the frame the call is made normally and its result returned.
+void VmCompiler::tail_call( Node *node, Node *callNode )
+{
+	u32 begin = emit( VmOp::TailBegin, callNode );
+	emit( VmOp::TailCall, callNode );
+	arguments( callNode );
+
+	chunk->code[ begin ].jump = here();
+	arguments( callNode );
+	chunk->code[ begin ].arg = emit( VmOp::Return, node );
+}
+
+VmChunk *vm_compile( Node *funcNode )
+{
+	VmCompiler compiler{ new VmChunk, 0, {} };
+
+	for ( auto child : funcNode->children )
+	{
+		compiler.exits.push_back( { 0, {}, {} } );
+		compiler.statement( child );
+		compiler.patch( compiler.exits.back().breaks, compiler.here() );
+		compiler.patch( compiler.exits.back().continues, compiler.here() );
+		compiler.exits.pop_back();
+	}
+	compiler.emit( VmOp::End, funcNode );
+
+	return compiler.chunk;
+}
+
+// -- frames --
+
+// Build with VM_THREADED=0 to time the switch on GCC or Clang
+#if !defined( VM_THREADED )
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define VM_THREADED 1
+#else
+#define VM_THREADED 0
+#endif
+#endif
+
+#if VM_THREADED
+#define VM_CASE( op ) case VmOp::op: op_##op
+#define VM_NEXT() \
+	do { instr = &code[ pc++ ]; node = instr->node; goto *dispatchTable[ static_cast<u8>( instr->op ) ]; } while ( 0 )
+#else
+#define VM_CASE( op ) case VmOp::op
+#define VM_NEXT() continue
+#endif
+
+// The condition of an If or While, fused comparisons skip building a Value
+static bool branch_taken( Interpreter *interpreter, Node *node )
+{
+	switch ( node->type )
+	{
+	case NodeID::IfCompare:
+	case NodeID::WhileCompare:
+		return interpreter->compare( node->left );
+
+	case NodeID::If:
+		return interpreter->run( node->left ).get_as_bool( interpreter, node );
+
+	default:
+		return interpreter->run( node->left ).get_as_bool( interpreter, node->left );
+	}
+}
+
+// Starts the function of the top frame, through native code when the JIT has
+// it. False with the result when native code ran the whole call.
+bool Interpreter::frame_enter( const VmInstr **code, u32 *pc, Value *value )
+{
+	Frame &frame = callStack.back();
+	Node *funcNode = frame.funcNode;
+
+	frame.region = ( jit.enabled ? jit.region( funcNode ) : nullptr );
+	if ( frame.region && jit_enter( funcNode, frame.region, nullptr, value ) )
+	{
+		returning = false;
+		scope_pop();
+		return false;
+	}
+
+	if ( !funcNode->chunk )
+	{
+		funcNode->chunk = vm_compile( funcNode );
+		chunks.push_back( funcNode->chunk );
+	}
+
+	*code = funcNode->chunk->code.data();
+	*pc = 0;
+	return true;
+}
+
+// Pops the top frame, its scopes already gone. False when native code called
+// it, which takes the result from run_frames.
+bool Interpreter::frame_leave( const VmInstr **code, u32 *pc, Value &value )
+{
+	const VmInstr *returnCode = callStack.back().returnCode;
+	u32 returnPc = callStack.back().returnPc;
+	callStack.pop_back();
+
+	if ( !returnCode )
+		return false;
+
+	*code = returnCode;
+	*pc = returnPc;
+	vmStack.push_back( std::move( value ) );
+	return true;
+}
+
+// Returns out of every loop and scope of the top frame
+void Interpreter::frame_unwind( Value &value )
+{
+	Frame &frame = callStack.back();
+
+	for ( u64 loopIdx = vmLoops.size(); loopIdx > frame.loopBase; --loopIdx )
+		jit_verify( vmLoops[ loopIdx - 1 ].node, vmLoops[ loopIdx - 1 ].region, true, value );
+	vmLoops.resize( frame.loopBase );
+	jit_verify( frame.funcNode, frame.region, true, value );
+
+	while ( scope > frame.baseScope )
+	{
+		// check if the value will go out of scope with the return
+		// it will have to pass-by-value
+		if ( value.deref().scope == scope )
+			value.unfold();
+		scope_pop();
+	}
+}
+
+// Hands the top frame to the callee of a tail call, its arguments are bound after
+void Interpreter::frame_tail( Node *node, Node *funcNode, Value *callContext )
+{
+	Frame &frame = callStack.back();
+
+	// native code has no calls, a region left through one can't be checked
+	if ( frame.region )
+		frame.region->verifying = false;
+
+	Value none;
+	for ( u64 loopIdx = vmLoops.size(); loopIdx > frame.loopBase; --loopIdx )
+		jit_verify( vmLoops[ loopIdx - 1 ].node, vmLoops[ loopIdx - 1 ].region, true, none );
+	vmLoops.resize( frame.loopBase );
+
+	while ( scope > frame.baseScope )
+		scope_pop();
+	scope_push( callContext );
+
+	frame.callNode = node;
+	frame.funcNode = funcNode;
+	frame.callSite = get_call_site( node, funcNode );
+}
+
+// Runs the frame invoke pushed until it returns, along with every script call
+// it makes. Calls push a Frame and jump to the callee's code, so recursion
+// costs heap rather than native stack.
+Value Interpreter::run_frames()
+{
+	const VmInstr *code = nullptr;
+	u32 pc = 0;
+
+	{
+		Value value;
+		if ( !frame_enter( &code, &pc, &value ) )
+		{
+			callStack.pop_back();
+			return value;
+		}
+	}
+
+#if VM_THREADED
+	static void *const dispatchTable[] =
+	{
+		&&op_Exec,
+		&&op_Eval,
+		&&op_Push,
+		&&op_Pop,
+		&&op_Index,
+		&&op_Operation,
+		&&op_Assign,
+		&&op_AssignOp,
+		&&op_AssignOpEntry,
+		&&op_AddConst,
+		&&op_Jump,
+		&&op_Branch,
+		&&op_BranchCompare,
+		&&op_JumpIfFalse,
+		&&op_ScopePush,
+		&&op_ScopePop,
+		&&op_CallBegin,
+		&&op_BindArg,
+		&&op_BindRun,
+		&&op_CallEnter,
+		&&op_TailBegin,
+		&&op_TailCall,
+		&&op_Return,
+		&&op_End,
+		&&op_ForBegin,
+		&&op_ForRange,
+		&&op_ForIter,
+		&&op_ForNext,
+		&&op_WhileBegin,
+		&&op_WhileInit,
+		&&op_WhileIter,
+		&&op_WhileCheck,
+		&&op_WhileNext,
+		&&op_LoopEnd,
+	};
+
+	static_assert( std::size( dispatchTable ) == static_cast<u64>( VmOp::LoopEnd ) + 1 );
+#endif
+
+	// the switch runs the first instruction, threaded handlers jump straight to the next one
+	const VmInstr *instr;
+	Node *node;
+
+	while ( true )
+	{
+		instr = &code[ pc++ ];
+		node = instr->node;
+
+		switch ( instr->op )
+		{
+		VM_CASE( Exec ):
+			{
+				Value value = run( node );
+				if ( !returning )
+					VM_NEXT();
+
+				returning = false;
+
+				if ( tailCall )
+				{
+					Node *callNode = tailCall;
+					tailCall = nullptr;
+					frame_tail( callNode, tailFunc, tailContext );
+
+					CallSite *callSite = callStack.back().callSite;
+					for ( u64 argIdx = 0; argIdx < callNode->children.size(); ++argIdx )
+						get_or_create_value( *callSite->argSlots[ argIdx ], scope ) = run( callNode->children[ argIdx ] );
+
+					if ( frame_enter( &code, &pc, &value ) )
+						VM_NEXT();
+				}
+				else
+				{
+					frame_unwind( value );
+				}
+
+				if ( !frame_leave( &code, &pc, value ) )
+					return value;
+			}
+			VM_NEXT();
+
+		VM_CASE( Eval ):
+			vmStack.push_back( run( node ) );
+			VM_NEXT();
+
+		VM_CASE( Push ):
+			vmStack.push_back( node->value );
+			VM_NEXT();
+
+		VM_CASE( Pop ):
+			vmStack.pop_back();
+			VM_NEXT();
+
+		VM_CASE( Index ):
+			{
+				// the slots may hold references, a result is pushed rather than assigned over them
+				Value index = std::move( vmStack.back() );
+				vmStack.pop_back();
+				Value base = std::move( vmStack.back() );
+				vmStack.pop_back();
+				vmStack.push_back( base[ index.get_as_i64( this, node ) ] );
+			}
+			VM_NEXT();
+
+		VM_CASE( Operation ):
+			{
+				u64 top = vmStack.size();
+				Value value = operation( node, vmStack[ top - 2 ], vmStack[ top - 1 ] );
+				vmStack.resize( top - 2 );
+				vmStack.push_back( std::move( value ) );
+			}
+			VM_NEXT();
+
+		VM_CASE( Assign ):
+			{
+				Value value = assign( node, std::move( vmStack.back() ) );
+				vmStack.pop_back();
+				vmStack.push_back( std::move( value ) );
+			}
+			VM_NEXT();
+
+		VM_CASE( AssignOp ):
+			{
+				Value rhs = std::move( vmStack.back() );
+				vmStack.pop_back();
+				Value value = assign_op( node, std::move( vmStack.back() ), rhs );
+				vmStack.pop_back();
+				vmStack.push_back( std::move( value ) );
+			}
+			VM_NEXT();
+
+		VM_CASE( AssignOpEntry ):
+			{
+				Value value = assign_op_entry( node, vmStack.back() );
+				vmStack.pop_back();
+				vmStack.push_back( std::move( value ) );
+			}
+			VM_NEXT();
+
+		VM_CASE( AddConst ):
+			{
+				Value &value = get_value( node->left ).deref();
+				i64 constant = node->right->value.valueI64;
+
+				if ( value.type == ValueType::NumberI64 )
+					value.valueI64 += ( node->token->id == TokenID::PlusAssign ? constant : -constant );
+				else
+					run( node );
+			}
+			VM_NEXT();
+
+		VM_CASE( Jump ):
+			pc = instr->jump;
+			VM_NEXT();
+
+		VM_CASE( Branch ):
+			if ( !branch_taken( this, node ) )
+				pc = instr->jump;
+			VM_NEXT();
+
+		VM_CASE( BranchCompare ):
+			if ( !compare( node->left ) )
+				pc = instr->jump;
+			VM_NEXT();
+
+		VM_CASE( JumpIfFalse ):
+			{
+				bool taken = vmStack.back().get_as_bool( this, node );
+				vmStack.pop_back();
+				if ( !taken )
+					pc = instr->jump;
+			}
+			VM_NEXT();
+
+		VM_CASE( ScopePush ):
+			scope_push();
+			VM_NEXT();
+
+		VM_CASE( ScopePop ):
+			for ( u32 i = 0; i < instr->arg; ++i )
+				scope_pop();
+			VM_NEXT();
+
+		VM_CASE( CallBegin ):
+		VM_CASE( TailBegin ):
+			{
+				bool tail = ( instr->op == VmOp::TailBegin );
+				u32 after = ( tail ? instr->arg : instr->jump );
+
+				chainedDotAccess = nullptr;
+
+				Value ret = run( node->left );
+				Value &callee = ret.deref();
+
+				if ( callee.type == ValueType::InbuiltFunc )
+				{
+					scope_push( chainedDotAccess );
+					vmStack.push_back( callee.valueInbuiltFunc( this, *context.back(), node ) );
+					scope_pop();
+					pc = after;
+					VM_NEXT();
+				}
+
+				if ( callee.type != ValueType::Node )
+					fatal( RESULT_CODE_NOT_CALLABLE, node, "Not callable \"{}\"", node->left->value.valueString );
+
+				Node *funcNode = callee.valueNode;
+				if ( !funcNode )
+				{
+					vmStack.push_back( Value() );
+					pc = after;
+					VM_NEXT();
+				}
+
+				Value *callContext = chainedDotAccess;
+				CallSite *callSite = get_call_site( node, funcNode );
+
+				if ( tail && tail_safe( callContext ) )
+				{
+					callStack.back().tailFunc = funcNode;
+					callStack.back().tailContext = callContext;
+					VM_NEXT();
+				}
+
+				if ( callStack.size() >= MaxCallDepth )
+					fatal( RESULT_CODE_CALL_DEPTH_EXCEEDED, node, "Call depth exceeded at {} frames.", callStack.size() );
+
+				callStack.push_back( { node, funcNode, callSite, nullptr, scope, vmLoops.size(), code, after, nullptr, nullptr } );
+				scope_push( callContext );
+
+				if ( tail )
+					pc = instr->jump;
+			}
+			VM_NEXT();
+
+		VM_CASE( BindArg ):
+			get_or_create_value( *callStack.back().callSite->argSlots[ instr->arg ], scope ) = std::move( vmStack.back() );
+			vmStack.pop_back();
+			VM_NEXT();
+
+		VM_CASE( BindRun ):
+			get_or_create_value( *callStack.back().callSite->argSlots[ instr->arg ], scope ) = run( node );
+			VM_NEXT();
+
+		VM_CASE( CallEnter ):
+			{
+				// only a frame a tail call took over can return straight to native code
+				Value value;
+				if ( !frame_enter( &code, &pc, &value ) && !frame_leave( &code, &pc, value ) )
+					return value;
+			}
+			VM_NEXT();
+
+		VM_CASE( TailCall ):
+			{
+				Frame &frame = callStack.back();
+				frame_tail( node, frame.tailFunc, frame.tailContext );
+			}
+			VM_NEXT();
+
+		VM_CASE( Return ):
+			{
+				Value value = std::move( vmStack.back() );
+				vmStack.pop_back();
+				frame_unwind( value );
+				if ( !frame_leave( &code, &pc, value ) )
+					return value;
+			}
+			VM_NEXT();
+
+		VM_CASE( End ):
+			{
+				Frame &frame = callStack.back();
+				jit_verify( frame.funcNode, frame.region, false, Value() );
+				while ( scope > frame.baseScope )
+					scope_pop();
+
+				Value value;
+				if ( !frame_leave( &code, &pc, value ) )
+					return value;
+			}
+			VM_NEXT();
+
+		VM_CASE( ForBegin ):
+			scope_push();
+			vmLoops.push_back( { node, nullptr, &get_or_create_value( node->left ), 0, 0, 0 } );
+			VM_NEXT();
+
+		VM_CASE( ForRange ):
+			{
+				VmLoop &loop = vmLoops.back();
+				loop.end = vmStack.back().get_as_i64( this, node->right->right );
+				vmStack.pop_back();
+				loop.at = vmStack.back().get_as_i64( this, node->right );
+				vmStack.pop_back();
+
+				i64 dir = ( loop.end - loop.at );
+				loop.dir = ( dir < 0 ? -1 : ( dir > 0 ? 1 : 0 ) );
+				loop.region = ( jit.enabled ? jit.region( node ) : nullptr );
+			}
+			VM_NEXT();
+
+		VM_CASE( ForIter ):
+			{
+				VmLoop &loop = vmLoops.back();
+
+				// on-stack replacement, native code runs the remaining iterations
+				Value value;
+				i64 state[ 3 ] = { loop.at, loop.end, loop.dir };
+				if ( loop.region && jit_enter( node, loop.region, state, &value ) )
+				{
+					scope_pop();
+					vmLoops.pop_back();
+
+					if ( !returning )
+					{
+						pc = instr->jump;
+						VM_NEXT();
+					}
+
+					returning = false;
+					frame_unwind( value );
+					if ( !frame_leave( &code, &pc, value ) )
+						return value;
+					VM_NEXT();
+				}
+
+				// only a full assignment when the body changed the variable type
+				if ( loop.var->type == ValueType::NumberI64 )
+					loop.var->valueI64 = loop.at;
+				else
+					*loop.var = loop.at;
+			}
+			VM_NEXT();
+
+		VM_CASE( ForNext ):
+			{
+				VmLoop &loop = vmLoops.back();
+				if ( loop.at == loop.end )
+					VM_NEXT();
+
+				loop.at += loop.dir;
+
+				// ForIter's on-stack replacement check only matters with a region
+				if ( loop.region || loop.var->type != ValueType::NumberI64 )
+				{
+					pc = instr->jump;
+					VM_NEXT();
+				}
+
+				loop.var->valueI64 = loop.at;
+				pc = instr->jump + 1;
+			}
+			VM_NEXT();
+
+		VM_CASE( WhileBegin ):
+			scope_push();
+			vmLoops.push_back( { node, nullptr, nullptr, 0, 0, 0 } );
+			VM_NEXT();
+
+		VM_CASE( WhileInit ):
+			{
+				VmLoop &loop = vmLoops.back();
+				loop.var = &get_or_create_value( LoopIndexName );
+				loop.region = ( jit.enabled ? jit.region( node ) : nullptr );
+			}
+			VM_NEXT();
+
+		VM_CASE( WhileIter ):
+			{
+				VmLoop &loop = vmLoops.back();
+				*loop.var = static_cast<i32>( loop.at++ );
+			}
+			VM_NEXT();
+
+		VM_CASE( WhileCheck ):
+		VM_CASE( WhileNext ):
+			{
+				VmLoop &loop = vmLoops.back();
+
+				// on-stack replacement, native code runs the remaining iterations
+				if ( loop.region )
+				{
+					Value value;
+					if ( jit_enter( node, loop.region, nullptr, &value ) )
+					{
+						if ( !returning )
+						{
+							pc = instr->jump;
+							VM_NEXT();
+						}
+
+						scope_pop();
+						vmLoops.pop_back();
+						returning = false;
+						frame_unwind( value );
+						if ( !frame_leave( &code, &pc, value ) )
+							return value;
+						VM_NEXT();
+					}
+				}
+
+				if ( instr->op == VmOp::WhileNext && branch_taken( this, node ) )
+					pc = instr->arg;
+			}
+			VM_NEXT();
+
+		VM_CASE( LoopEnd ):
+			jit_verify( node, vmLoops.back().region, false, Value() );
+			scope_pop();
+			vmLoops.pop_back();
+			VM_NEXT();
+		}
+	}
+}
+
+// -- native stack --
+
+u64 stack_space_below( const char *base )
+{
+	uintptr_t addr = reinterpret_cast<uintptr_t>( base );
+	uintptr_t low = 0;
+
+#if defined( _WIN32 )
+	ULONG_PTR limitLow;
+	ULONG_PTR limitHigh;
+	GetCurrentThreadStackLimits( &limitLow, &limitHigh );
+	low = limitLow;
+#elif defined( __APPLE__ )
+	pthread_t self = pthread_self();
+	low = reinterpret_cast<uintptr_t>( pthread_get_stackaddr_np( self ) ) - pthread_get_stacksize_np( self );
+#else
+	pthread_attr_t attr;
+	void *stackAddr;
+	size_t stackSize;
+	if ( pthread_getattr_np( pthread_self(), &attr ) == 0 )
+	{
+		if ( pthread_attr_getstack( &attr, &stackAddr, &stackSize ) == 0 )
+			low = reinterpret_cast<uintptr_t>( stackAddr );
+		pthread_attr_destroy( &attr );
+	}
+
+	// the main thread's stack can grow to the limit, measured from near its top
+	struct rlimit limit;
+	if ( !low && getrlimit( RLIMIT_STACK, &limit ) == 0 && limit.rlim_cur != RLIM_INFINITY )
+		low = addr - std::min<uintptr_t>( addr, limit.rlim_cur );
+#endif
+
+	return addr > low ? addr - low : 0;
+}
@@ -0,0 +1,83 @@
+
+#pragma once
+
+#include <vector>
+
+#include "parser.h"
+
+// Function bodies run as a flat list of instructions over an explicit frame
+// stack, so a script call pushes a Frame instead of nesting run on the native
+// stack. Control flow and the expressions around a call get instructions of
+// their own, as do loops, branches and x += const wherever they are. Other
+// code without calls is handed back to the tree walker whole.
+//
+// run_frames keeps a handler per op. GCC and Clang thread them through a
+// label table, so each handler ends in its own indirect jump, elsewhere they
+// are the cases of a switch. The order here is the order of that table.
+enum class VmOp : u8
+{
+	Exec,			// run the node as a statement, a return inside it leaves the frame
+	Eval,			// push run( node )
+	Push,			// push the node's value
+	Pop,
+	Index,			// pop index and array, push the entry
+	Operation,		// pop rhs and lhs, push the result
+	Assign,			// pop the right hand side and store it, push it back
+	AssignOp,		// pop rhs and target, push the result
+	AssignOpEntry,	// pop rhs, the indexed target runs now
+	AddConst,		// x += const or x -= const, in place while x holds an i64
+	Jump,
+	Branch,			// jump when the If or While condition fails
+	BranchCompare,	// Branch for IfCompare and WhileCompare, compares without building a bool Value
+	JumpIfFalse,
+	ScopePush,
+	ScopePop,		// pops arg scopes
+	CallBegin,		// run the callee, a builtin pushes its result and jumps, a script function gets a frame
+	BindArg,		// pop into parameter arg of the frame being called
+	BindRun,		// run the node into parameter arg
+	CallEnter,
+	TailBegin,		// as CallBegin for a returned call, falls through to TailCall when it may take over the frame
+	TailCall,		// hand the frame to the callee, its arguments bind after
+	Return,			// pop the result and leave the frame
+	End,			// fell off the end of the function
+	ForBegin,
+	ForRange,		// pop end and start
+	ForIter,		// on-stack replacement check, then set the loop variable
+	ForNext,		// step the counter and go back into the body, through ForIter while on-stack replacement can take over
+	WhileBegin,
+	WhileInit,
+	WhileIter,
+	WhileCheck,		// on-stack replacement check before the condition runs again
+	WhileNext,		// WhileCheck then back to arg while a condition without calls holds
+	LoopEnd,		// keep last, it sizes the dispatch table
+};
+
+struct VmInstr
+{
+	VmOp op;
+	u32 arg;
+	u32 jump;
+	Node *node;
+};
+
+struct VmChunk
+{
+	std::vector<VmInstr> code;
+};
+
+// A loop the frame loop is running
+struct VmLoop
+{
+	Node *node;
+	JitRegion *region;
+	// the loop variable, or lidx for a while loop
+	Value *var;
+	i64 at;
+	i64 end;
+	i64 dir;
+};
+
+VmChunk *vm_compile( Node *funcNode );
+
+// Bytes of native stack the calling thread has below base
+u64 stack_space_below( const char *base );
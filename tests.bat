@@ -17,6 +17,34 @@ call:run_test looping
 call:run_test objects
 call:run_test printing
 call:run_test misc
+call:run_test collections
+call:run_test strings
+call:run_test recursion
+
+:: inlining must give what the calls it replaces give
+call:run_test functions -O0
+
+:: native regions checked against the interpreter, compiled on first entry
+call:run_test functions "--jit --jit-diff --jit-threshold=1"
+call:run_test looping "--jit --jit-diff --jit-threshold=1"
+
+:: lines piped into stdin
+(echo first& echo second& echo third) | azcode.exe %mypath%example\stdin.aas > NUL
+if %ERRORLEVEL% == 0 (
+	echo !ESC![7m[Success]!ESC![0m : stdin
+) else (
+	echo !ESC![101;93m[ Failed]!ESC![0m : stdin
+)
+
+:: emitted C++ built with AZCODE_AOT must print what the interpreter prints,
+:: misc is left out as it prints the program path and recursion as translated
+:: code calls script functions on the native stack
+where cl > NUL 2> NUL
+if %ERRORLEVEL% == 0 (
+	for %%t in (arithmetic arrays files functions imports looping objects printing collections strings) do call:run_aot_test %%t
+) else (
+	echo cl not found, run vcvars64 for the AOT tests
+)
 
 popd
 exit /b
@@ -24,10 +52,27 @@ exit /b
 :: ----------------------------------------------
 
 :run_test
-azcode.exe %mypath%example\%1.aas > NUL
+azcode.exe %~2 %mypath%example\%1.aas > NUL
+if %ERRORLEVEL% == 0 (
+	echo !ESC![7m[Success]!ESC![0m : %1 %~2
+) else (
+	echo !ESC![101;93m[ Failed]!ESC![0m : %1 %~2
+)
+exit /b
+
+:: ----------------------------------------------
+
+:run_aot_test
+azcode.exe %mypath%example\%1.aas > aot_%1_interpreted.txt
+azcode.exe --emit-cpp=aot_%1.cpp %mypath%example\%1.aas > NUL
+cl -nologo -std:c++latest -Zc:preprocessor -Zc:strictStrings -GR- -WX -W4 -wd4189 -wd4201 -wd4324 -wd4505 -D_CRT_SECURE_NO_WARNINGS -D_HAS_EXCEPTIONS=0 -DOS_NAME=\"Windows\" -I%mypath%src -Feaot_%1.exe -Foaot_%1.obj aot_%1.cpp -link ws2_32.lib > NUL
+if %ERRORLEVEL% == 0 (
+	aot_%1.exe > aot_%1_compiled.txt
+	fc /b aot_%1_interpreted.txt aot_%1_compiled.txt > NUL
+)
 if %ERRORLEVEL% == 0 (
-	echo !ESC![7m[Success]!ESC![0m : %1
+	echo !ESC![7m[Success]!ESC![0m : %1 AOT
 ) else (
-	echo !ESC![101;93m[ Failed]!ESC![0m : %1
+	echo !ESC![101;93m[ Failed]!ESC![0m : %1 AOT
 )
 exit /b
\ No newline at end of file